@@ -31,9 +31,29 @@ SOFTWARE.
 
 #include <vector>
 #include <cstdint>
-#include <../src/Chess.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <../src/Pieces.h>
 #include <stdlib.h>
 
+// Finds magic numbers for the engine's slider attack tables and prints them as a header.
+//
+// Usage: chess-engine-magic [--threads N] [--layout fancy|black] [--target-kib N] [--attempts N] [--seed N]
+//
+//  fancy   Each square gets its own block of 2^bits entries, indexed by ((occupied & mask) * magic) >> shift.
+//          With bits = popcount(mask) these are the magics in src/MagicNumbers.h.
+//  black   "Black magic": the index is ((occupied | ~mask) * magic) >> shift and the per-square blocks
+//          are packed into one table at offsets where they overlap compatibly, sharing slots.
+//
+// With --target-kib, squares are retried with one fewer index bit (allowing constructive collisions)
+// until the tables fit or no more squares can be shrunk. Each square uses its own RNG seeded from the
+// square, so the output doesn't depend on the number of threads.
+
 std::vector<std::pair<int, int>> bishop_moves = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1}};
 std::vector<std::pair<int, int>> rook_moves   = {{1, 0}, {-1, 0}, { 0, 1},  {0, -1}};
 
@@ -94,19 +114,6 @@ uint64_t get_rook_occupancy_set_for_square(int sq)
 }
 
 
-void seedRNG()
-{
-    srandom(0x666);
-}
-
-uint64_t gen64BitMagicNumber()
-{
-    // TODO: Change this for a better random number generator
-    uint64_t r = (random() << 32) | random();
-    
-    return r;
-}
-
 int population_count(uint64_t bb)
 {
     int sum = 0;
@@ -121,115 +128,362 @@ int population_count(uint64_t bb)
     return sum;
 }
 
-bool testMagic(uint64_t bb, uint64_t magic)
+uint64_t sliding_attacks(int sq, uint64_t occupied, bool rook)
 {
+    int x1 = sq & 7;
+    int y1 = sq >> 3;
 
-    // Count bits in bb
+    uint64_t bb = 0;
 
-    int count = population_count(bb);
+    for (const auto& m : rook ? rook_moves : bishop_moves)
+    {
+        for (int i = 1; i < 8; i++)
+        {
+            int x2 = x1 + i*m.first;
+            int y2 = y1 + i*m.second;
 
-    int used[4096] = {0};
+            if (!IS_IN_BOARD(x2, y2)) break;
 
-    for (int i = 1; i <= (1<<count); i++)
-    {
-        // Enumerate occupancy set with binary counter
-        
-        uint64_t occupied_bb = 0;
-        int j = i;
+            bb |= COORD_TO_BIT(x2, y2);
 
-        for (uint64_t b = bb; b != 0; b &= b - 1)
-        {
-            uint64_t bit = b & -b;
+            if (occupied & COORD_TO_BIT(x2, y2)) break;
+        }
+    }
 
-            if (j & 1) occupied_bb |= bit;
+    return bb;
+}
 
-            j >>= 1;
-        } 
-   
-        // Multiply by magic
-   
-        uint64_t mult = occupied_bb * magic; 
+// xorshift64*: https://www.chessprogramming.org/Pseudo-Random_Number_Generator
+struct Rng {
+    uint64_t s;
 
-        //if (population_count(mult & 0xff00'0000'0000'0000) < 6) return false;
+    Rng(uint64_t seed) : s(seed ? seed : 0x9e3779b97f4a7c15ULL) {}
 
-        // Shift by bits in occupancy set
+    uint64_t next()
+    {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 2685821657736338717ULL;
+    }
 
-        mult >>= (64 - count);
+    uint64_t fewbits() { return next() & next() & next(); }
+};
 
-        //printf("%ld %d\n", mult, i);
+enum Layout { LAYOUT_FANCY, LAYOUT_BLACK };
 
-        // Does resulting bit set match the generated count? If not, return false.
+struct SquareMagic {
+    uint64_t mask;
+    uint64_t magic;
+    int      bits;
+    uint32_t offset;
 
-        //if (mult != (uint64_t)i) return false;
+    std::vector<uint64_t> occupancies;
+    std::vector<uint64_t> attacks;
+    std::vector<uint64_t> table;        // This square's block, 0 for unused entries
+};
 
-        if (used[mult] == 0) 
-            used[mult] = i;
-        else if (used[mult] != i) 
-            return false;
+struct Options {
+    int      threads  = (int)std::max(1U, std::thread::hardware_concurrency());
+    Layout   layout   = LAYOUT_FANCY;
+    size_t   targetKiB = 0;
+    uint64_t attempts = 10'000'000; // Per square, when trying to shrink it
+    uint64_t seed     = 0x666;
+};
+
+uint64_t magic_index(const SquareMagic& m, uint64_t occupied, uint64_t magic, int bits, Layout layout)
+{
+    uint64_t b = (layout == LAYOUT_BLACK) ? (occupied | ~m.mask) : (occupied & m.mask);
+    return (b * magic) >> (64 - bits);
+}
 
+// Try a magic, filling block. Occupancies may share an entry if their attack sets are the same.
+bool testMagic(const SquareMagic& m, uint64_t magic, int bits, Layout layout, std::vector<uint64_t>& block)
+{
+    block.assign(1ULL << bits, 0);
+
+    for (size_t i = 0; i < m.occupancies.size(); i++)
+    {
+        uint64_t idx = magic_index(m, m.occupancies[i], magic, bits, layout);
+
+        if (block[idx] == 0)
+            block[idx] = m.attacks[i];
+        else if (block[idx] != m.attacks[i])
+            return false;
     }
 
     return true;
 }
 
-uint64_t random_uint64_t() {
-  uint64_t u1, u2, u3, u4;
-  u1 = (uint64_t)(random()) & 0xFFFF; u2 = (uint64_t)(random()) & 0xFFFF;
-  u3 = (uint64_t)(random()) & 0xFFFF; u4 = (uint64_t)(random()) & 0xFFFF;
-  return u1 | (u2 << 16) | (u3 << 32) | (u4 << 48);
+bool findMagic(SquareMagic& m, int bits, Layout layout, Rng& rng, uint64_t attempts)
+{
+    std::vector<uint64_t> block;
+
+    for (uint64_t n = 0; n < attempts; n++)
+    {
+        // Sparse candidates find ordinary magics quickly, but magics with fewer bits than the
+        // mask rely on constructive collisions and turn up more often among dense ones
+        uint64_t magic = (n & 1) ? rng.next() : rng.fewbits();
+
+        // Quick reject: the mask needs to spread into the top bits of the product
+        if (layout == LAYOUT_FANCY && population_count((m.mask * magic) & 0xFF00'0000'0000'0000ULL) < std::min(bits, 6)) continue;
+
+        if (testMagic(m, magic, bits, layout, block))
+        {
+            m.magic = magic;
+            m.bits  = bits;
+            m.table.swap(block);
+            return true;
+        }
+    }
+
+    return false;
 }
 
-uint64_t random_uint64_t_fewbits() {
-  return random_uint64_t() & random_uint64_t() & random_uint64_t();
+void setupSquare(SquareMagic& m, int sq, bool rook)
+{
+    m.mask = rook ? get_rook_occupancy_set_for_square(sq) : get_bishop_occupancy_set_for_square(sq);
+    m.bits = population_count(m.mask);
+
+    // Enumerate all subsets of the mask (Carry-Rippler)
+    uint64_t occ = 0;
+
+    do {
+        m.occupancies.push_back(occ);
+        m.attacks.push_back(sliding_attacks(sq, occ, rook));
+        occ = (occ - m.mask) & m.mask;
+    } while (occ);
 }
 
-int main(int argc, char** argv)
+// Run f(i) for i in [0, n) on a pool of threads
+template <typename Func>
+void parallelFor(int n, int threads, Func f)
 {
-    (void) argc;
-    (void) argv;
+    std::atomic<int> next(0);
+    std::vector<std::thread> pool;
 
-    //seedRNG();
+    for (int t = 0; t < threads; t++)
+        pool.emplace_back([&] () { for (int i = next++; i < n; i = next++) f(i); });
 
-    // Compute magics for rooks
+    for (auto& t : pool)
+        t.join();
+}
+
+// Lay out the per-square blocks and return the table size in entries. Fancy blocks are placed
+// one after the other; black magic blocks are placed at the first offset where every entry
+// they use is either free or already holds the same attack set.
+size_t packTables(SquareMagic* squares, Layout layout, std::vector<uint64_t>& table)
+{
+    table.clear();
 
     for (int sq = 0; sq < 64; sq++)
     {
-        uint64_t bb = get_rook_occupancy_set_for_square(sq);
+        SquareMagic& m = squares[sq];
+        size_t offset = table.size();
 
-        while (true)
+        if (layout == LAYOUT_BLACK)
         {
-            uint64_t magic =  random_uint64_t_fewbits(); //0x100420000431024ULL; //gen64BitMagicNumber();
-    
-            if (testMagic(bb, magic))
+            for (offset = 0; offset < table.size(); offset++)
             {
-                printf("Magic found for rook on sq %d %lx, bb = %lx\n", sq, magic, bb);
-                //return 0;
-                break;
+                bool fits = true;
+
+                for (size_t i = 0; i < m.table.size() && offset + i < table.size() && fits; i++)
+                    fits = (m.table[i] == 0 || table[offset + i] == 0 || m.table[i] == table[offset + i]);
+
+                if (fits) break;
             }
+        }
+
+        m.offset = (uint32_t)offset;
+
+        if (table.size() < offset + m.table.size())
+            table.resize(offset + m.table.size(), 0);
+
+        for (size_t i = 0; i < m.table.size(); i++)
+            if (m.table[i]) table[offset + i] = m.table[i];
+    }
+
+    return table.size();
+}
+
+size_t tableBytes(SquareMagic* rooks, SquareMagic* bishops, Layout layout)
+{
+    std::vector<uint64_t> table;
+    return (packTables(rooks, layout, table) + packTables(bishops, layout, table)) * sizeof(uint64_t);
+}
+
+// Time random lookups in the packed tables, and check them against the slow attack generator
+double benchmark(SquareMagic* squares, Layout layout, const std::vector<uint64_t>& table, bool rook)
+{
+    constexpr int kSamples = 1 << 16;
+    constexpr int kRounds  = 64;
+
+    Rng rng(12345);
+    std::vector<uint64_t> occ(kSamples);
+
+    for (auto& o : occ)
+        o = rng.next() & rng.next();
+
+    for (int i = 0; i < kSamples; i++)
+    {
+        const SquareMagic& m = squares[i & 63];
 
+        if (table[m.offset + magic_index(m, occ[i], m.magic, m.bits, layout)] != sliding_attacks(i & 63, occ[i], rook))
+        {
+            fprintf(stderr, "Lookup mismatch on square %d\n", i & 63);
+            exit(1);
         }
+    }
+
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
 
+    for (int r = 0; r < kRounds; r++)
+    {
+        for (int i = 0; i < kSamples; i++)
+        {
+            const SquareMagic& m = squares[(i + r) & 63];
+            sum += table[m.offset + magic_index(m, occ[i], m.magic, m.bits, layout)];
+        }
     }
 
-    // Compute magics for bishops
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // Keep the loop from being optimised away
+    if (sum == 1) fprintf(stderr, " ");
+
+    return ns / kSamples / kRounds;
+}
+
+void printArray(const char* type, const char* name, SquareMagic* squares, uint64_t (*value)(const SquareMagic&))
+{
+    printf("constexpr %s %s[64] = {\n", type, name);
 
     for (int sq = 0; sq < 64; sq++)
     {
-        uint64_t bb = get_bishop_occupancy_set_for_square(sq);
+        if (strcmp(type, "uint64_t") == 0)
+            printf("%s0x%016lxULL,%s", (sq & 3) ? " " : "    ", value(squares[sq]), ((sq & 3) == 3) ? "\n" : "");
+        else
+            printf("%s%6lu,%s", (sq & 7) ? " " : "    ", value(squares[sq]), ((sq & 7) == 7) ? "\n" : "");
+    }
+
+    printf("};\n\n");
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: chess-engine-magic [--threads N] [--layout fancy|black] [--target-kib N] [--attempts N] [--seed N]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (i + 1 >= argc) usage();
 
-        while (true)
+        if (arg == "--threads")
+            opt.threads = std::max(1, atoi(argv[++i]));
+        else if (arg == "--layout")
         {
-            uint64_t magic =  random_uint64_t_fewbits(); //0x100420000431024ULL; //gen64BitMagicNumber();
-    
-            if (testMagic(bb, magic))
-            {
-                printf("Magic found for bishop on sq %d %lx\n", sq, magic);
-                //return 0;
-                break;
-            }
+            std::string layout = argv[++i];
 
+            if (layout == "fancy")      opt.layout = LAYOUT_FANCY;
+            else if (layout == "black") opt.layout = LAYOUT_BLACK;
+            else usage();
         }
+        else if (arg == "--target-kib")
+            opt.targetKiB = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--attempts")
+            opt.attempts = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--seed")
+            opt.seed = strtoull(argv[++i], nullptr, 0);
+        else
+            usage();
+    }
+
+    static SquareMagic rooks[64];
+    static SquareMagic bishops[64];
+
+    auto start = std::chrono::steady_clock::now();
+
+    // 0-63 are the rook squares, 64-127 the bishop squares
+    auto square = [&] (int i) -> SquareMagic& { return (i < 64) ? rooks[i] : bishops[i - 64]; };
+
+    for (int i = 0; i < 128; i++)
+        setupSquare(square(i), i & 63, i < 64);
+
+    std::vector<Rng> rngs;
+
+    for (int i = 0; i < 128; i++)
+        rngs.emplace_back(opt.seed ^ ((uint64_t)(i + 1) * 0x9e3779b97f4a7c15ULL));
+
+    // Every square has a magic at popcount(mask) bits
+    parallelFor(128, opt.threads, [&] (int i) {
+        SquareMagic& m = square(i);
+
+        while (!findMagic(m, m.bits, opt.layout, rngs[i], opt.attempts))
+            ;
+    });
+
+    // Shrink every square by a bit per round, all squares at once, until the target size is
+    // reached or no square can shrink. A round can take the tables some way under the target.
+    for (bool progress = true; opt.targetKiB && progress && tableBytes(rooks, bishops, opt.layout) > opt.targetKiB * 1024; )
+    {
+        std::vector<char> shrunk(128, 0);
+
+        parallelFor(128, opt.threads, [&] (int i) {
+            SquareMagic& m = square(i);
+            SquareMagic trial = m;
 
+            if (m.bits > 1 && findMagic(trial, m.bits - 1, opt.layout, rngs[i], opt.attempts))
+            {
+                m = std::move(trial);
+                shrunk[i] = 1;
+            }
+        });
+
+        progress = std::count(shrunk.begin(), shrunk.end(), 1) > 0;
     }
 
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint64_t> rookTable, bishopTable;
+    size_t rookEntries   = packTables(rooks, opt.layout, rookTable);
+    size_t bishopEntries = packTables(bishops, opt.layout, bishopTable);
+    size_t bytes = (rookEntries + bishopEntries) * sizeof(uint64_t);
+
+    fprintf(stderr, "Found magics in %1.2f s with %d threads\n", secs, opt.threads);
+    fprintf(stderr, "Table size: %zu rook + %zu bishop entries, %1.1f KiB%s\n", rookEntries, bishopEntries, bytes / 1024.0,
+            (opt.targetKiB && bytes > opt.targetKiB * 1024) ? " (target not reached)" : "");
+    fprintf(stderr, "Lookup: rook %1.2f ns, bishop %1.2f ns\n", benchmark(rooks, opt.layout, rookTable, true),
+            benchmark(bishops, opt.layout, bishopTable, false));
+
+    printf("// Generated by magic/main.cpp: %s layout, %zu rook + %zu bishop entries\n\n",
+            opt.layout == LAYOUT_BLACK ? "black magic" : "fancy", rookEntries, bishopEntries);
+    printf("#pragma once\n\n#include <cstdint>\n\n");
+
+    printArray("uint64_t", "kRookMagics", rooks, [] (const SquareMagic& m) { return m.magic; });
+    printArray("uint64_t", "kBishopMagics", bishops, [] (const SquareMagic& m) { return m.magic; });
+
+    // Only needed if the layout isn't plain fancy magics with popcount(mask) bits
+    bool custom = (opt.layout != LAYOUT_FANCY);
+
+    for (int sq = 0; sq < 64; sq++)
+        custom |= (rooks[sq].bits != population_count(rooks[sq].mask)) || (bishops[sq].bits != population_count(bishops[sq].mask));
+
+    if (custom)
+    {
+        printArray("uint32_t", "kRookShifts", rooks, [] (const SquareMagic& m) { return (uint64_t)(64 - m.bits); });
+        printArray("uint32_t", "kRookOffsets", rooks, [] (const SquareMagic& m) { return (uint64_t)m.offset; });
+        printArray("uint32_t", "kBishopShifts", bishops, [] (const SquareMagic& m) { return (uint64_t)(64 - m.bits); });
+        printArray("uint32_t", "kBishopOffsets", bishops, [] (const SquareMagic& m) { return (uint64_t)m.offset; });
+
+        printf("constexpr int kRookTableSize   = %zu;\n", rookEntries);
+        printf("constexpr int kBishopTableSize = %zu;\n", bishopEntries);
+    }
 }
@@ -0,0 +1,56 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+AttackTables.h: Process-wide move and attack lookup tables
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+
+#pragma once
+
+#include <Blockers.h>
+#include <MagicBitboards.h>
+
+// The lookup tables only depend on the geometry of the board, so they are built once, on first
+// use, and shared read-only by every engine instance and search thread in the process.
+
+class AttackTables {
+
+    public:
+
+        static const AttackTables& get();
+
+        Blockers       blockers;
+        MagicBitboards magics;
+
+    private:
+
+        AttackTables();
+
+        AttackTables(const AttackTables&) = delete;
+        AttackTables& operator=(const AttackTables&) = delete;
+};
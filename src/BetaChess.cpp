@@ -30,30 +30,194 @@ SOFTWARE.
 */
 
 #include <BetaChess.h>
+#include <sstream>
+#include <cstdio>
 
-uint64_t BetaChess::perft(int depth)
+uint64_t BetaChess::perft(int depth, bool bulk)
 {
 
+    CHECK_ZOBRIST(m_board);
+
     if (depth == 0) return 1ULL;
 
     struct BetaMove moves[256];
 
     int n = generate_moves(moves);
-    int nodes = 0;
+
+    // generate_moves only returns legal moves, so the last ply is just the count
+    if (bulk && depth == 1) return n;
+
+    uint64_t nodes = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        m_board.makeMove(moves[i]);
+
+            nodes += perft(depth - 1, bulk);
+
+        m_board.unmakeMove(moves[i]);
+
+    }
+
+    return nodes;
+}
+
+uint64_t BetaChess::perftDivide(int depth, std::vector<std::pair<std::string, uint64_t>>& divide, bool bulk)
+{
+    divide.clear();
+
+    if (depth < 1) return perft(depth, bulk);
+
+    struct BetaMove moves[256];
+
+    int n = generate_moves(moves);
+    uint64_t nodes = 0;
 
     for (int i = 0; i < n; i++)
     {
         m_board.makeMove(moves[i]);
 
-            nodes += perft(depth - 1);
+            uint64_t count = perft(depth - 1, bulk);
 
         m_board.unmakeMove(moves[i]);
 
+        divide.emplace_back(moveToString(moves[i]), count);
+        printf("%s: %lu\n", divide.back().first.c_str(), count);
+
+        nodes += count;
     }
 
+    printf("\nNodes searched: %lu\n", nodes);
+
     return nodes;
 }
 
+// Coordinate notation, e.g. e2e4 or e7e8q
+std::string BetaChess::moveToString(const struct BetaMove& move)
+{
+    std::string str = { (char)('a' + (move.sq_from & 7)), (char)('1' + (move.sq_from >> 3)),
+                        (char)('a' + (move.sq_to & 7)),   (char)('1' + (move.sq_to >> 3)) };
+
+    if (move.flags == IS_PROMOTE || move.flags == IS_PROMOTE_CAPTURE)
+    {
+        const char promo[] = { ' ', ' ', ' ', 'n', 'b', 'r', 'q', ' ' };
+        str += promo[move.to_piece];
+    }
+
+    return str;
+}
+
+// Set up the board from a FEN string: https://www.chessprogramming.org/Forsyth-Edwards_Notation
+// The half move clock and move number are ignored.
+bool BetaChess::setBoardFromFEN(const std::string& fen)
+{
+    std::istringstream ss(fen);
+    std::string placement, side, castling, ep;
+
+    ss >> placement >> side >> castling >> ep;
+
+    if (ss.fail()) return false;
+
+    BetaBoard board;
+
+    board.bitboards_color[BITBOARD_WHITE_PIECES] = 0;
+    board.bitboards_color[BITBOARD_BLACK_PIECES] = 0;
+
+    for (int piece = 0; piece < 8; piece++)
+        board.bitboards_piece[piece] = 0;
+
+    int sq = 56;
+
+    for (char c : placement)
+    {
+        if (c == '/')
+        {
+            sq -= 16;
+            continue;
+        }
+
+        if (c >= '1' && c <= '8')
+        {
+            sq += c - '0';
+            continue;
+        }
+
+        int piece;
+
+        switch (c | 0x20)   // lower case
+        {
+            case 'p': piece = BITBOARD_PAWN;   break;
+            case 'n': piece = BITBOARD_KNIGHT; break;
+            case 'b': piece = BITBOARD_BISHOP; break;
+            case 'r': piece = BITBOARD_ROOK;   break;
+            case 'q': piece = BITBOARD_QUEEN;  break;
+            case 'k': piece = BITBOARD_KING;   break;
+            default:
+                return false;
+        }
+
+        if (sq < 0 || sq > 63) return false;
+
+        board.bitboards_color[(c & 0x20) ? BITBOARD_BLACK_PIECES : BITBOARD_WHITE_PIECES] |= 1ULL << sq;
+        board.bitboards_piece[piece] |= 1ULL << sq;
+        sq++;
+    }
+
+    board.turn = (side == "b") ? TURN_BLACK : TURN_WHITE;
+
+    board.castling = 0;
+
+    for (char c : castling)
+    {
+        switch (c)
+        {
+            case 'K': board.castling |= CASTLE_WHITE_KING_SIDE;  break;
+            case 'Q': board.castling |= CASTLE_WHITE_QUEEN_SIDE; break;
+            case 'k': board.castling |= CASTLE_BLACK_KING_SIDE;  break;
+            case 'q': board.castling |= CASTLE_BLACK_QUEEN_SIDE; break;
+        }
+    }
+
+    board.ep_sq = 0;
+
+    if (ep.size() == 2 && ep[0] >= 'a' && ep[0] <= 'h' && ep[1] >= '1' && ep[1] <= '8')
+        board.ep_sq = (ep[0] - 'a') + (ep[1] - '1') * 8;
+
+    board.m_hash = board.computeHash();
+
+    m_board = board;
+
+    return true;
+}
+
+int BetaChess::generate_moves(struct BetaMove* moves)
+{
+    int color = m_board.turn;
+    int n;
+
+    // TODO: Get rid of branch
+    if (m_board.turn == TURN_WHITE)
+        n = _generate_moves_white(moves);
+    else
+        n = _generate_moves_black(moves);
+
+    // Keep only the moves which don't leave our king in check
+    int nLegal = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        m_board._makeMove(moves[i]);
+
+        bool legal = !squareAttacked(bitScanForward(*m_board.kings() & m_board.bitboards_color[color]), color ^ 1);
+
+        m_board._makeMove(moves[i]);
+
+        if (legal) moves[nLegal++] = moves[i];
+    }
+
+    return nLegal;
+}
+
 #define MAKE_MOVE_WHITE(from, to, pieceFrom, pieceTo)   moves[n_moves].sq_from = from;    \
                                     moves[n_moves].sq_to   = to;      \
                                                                         \
@@ -106,15 +270,35 @@ int BetaChess::_generate_moves_white(struct BetaMove* moves)
 
     }
 
+    // Castling. The king may not castle out of, through or into check.
+    if ((m_board.castling & CASTLE_WHITE_KING_SIDE) && !(allPieces & 0x0000'0000'0000'0060) &&
+        !squareAttacked(4, BITBOARD_BLACK_PIECES) && !squareAttacked(5, BITBOARD_BLACK_PIECES) && !squareAttacked(6, BITBOARD_BLACK_PIECES))
+    {
+        uint64_t m = 1ULL << 6;
+
+        MAKE_MOVE_WHITE(4, 6, BITBOARD_KING, BITBOARD_KING);
+        moves[n_moves].flags = IS_CASTLE;
+        n_moves++;
+    }
+
+    if ((m_board.castling & CASTLE_WHITE_QUEEN_SIDE) && !(allPieces & 0x0000'0000'0000'000e) &&
+        !squareAttacked(4, BITBOARD_BLACK_PIECES) && !squareAttacked(3, BITBOARD_BLACK_PIECES) && !squareAttacked(2, BITBOARD_BLACK_PIECES))
+    {
+        uint64_t m = 1ULL << 2;
+
+        MAKE_MOVE_WHITE(4, 2, BITBOARD_KING, BITBOARD_KING);
+        moves[n_moves].flags = IS_CASTLE;
+        n_moves++;
+    }
+
     // Pawn moves
     for (uint64_t bb = m_board.whitePawns(); bb != 0; bb &= bb - 1)
     {
     
         uint64_t pawn   = bb & -bb;
         int pawnSq      = bitScanForward(pawn);
-        uint64_t mmoves  = m_blockers.m_pawnMovesWhite[pawnSq];
-
-        mmoves &= ~(myPieces | theirPieces);
+        uint64_t push   = (pawn << 8) & ~allPieces;
+        uint64_t mmoves = push | (((push & 0x0000'0000'00ff'0000) << 8) & ~allPieces);
 
         uint64_t captures = m_blockers.m_pawnAttacksWhite[pawnSq];
 
@@ -128,10 +312,32 @@ int BetaChess::_generate_moves_white(struct BetaMove* moves)
 
             int toSq = bitScanForward(m); // Get to square   
 
-            MAKE_MOVE_WHITE(pawnSq, toSq, BITBOARD_PAWN, BITBOARD_PAWN);
-            
-            n_moves++;
+            if (m & 0xff00'0000'0000'0000)
+            {
+                for (int piece = BITBOARD_QUEEN; piece >= BITBOARD_KNIGHT; piece--)
+                {
+                    MAKE_MOVE_WHITE(pawnSq, toSq, BITBOARD_PAWN, piece);
+                    moves[n_moves].flags |= IS_PROMOTE;
+                    n_moves++;
+                }
+            }
+            else
+            {
+                MAKE_MOVE_WHITE(pawnSq, toSq, BITBOARD_PAWN, BITBOARD_PAWN);
+                n_moves++;
+            }
+
+        }
+
+        // En passant
+        if (m_board.ep_sq && (m_blockers.m_pawnAttacksWhite[pawnSq] & (1ULL << m_board.ep_sq)))
+        {
+            uint64_t m = 1ULL << m_board.ep_sq;
 
+            MAKE_MOVE_WHITE(pawnSq, m_board.ep_sq, BITBOARD_PAWN, BITBOARD_PAWN);
+            moves[n_moves].capture_piece = BITBOARD_PAWN;
+            moves[n_moves].flags         = IS_EN_PASSENT;
+            n_moves++;
         }
     }
 
@@ -283,17 +489,37 @@ int BetaChess::_generate_moves_black(struct BetaMove* moves)
 
     }
 
+    // Castling. The king may not castle out of, through or into check.
+    if ((m_board.castling & CASTLE_BLACK_KING_SIDE) && !(allPieces & 0x6000'0000'0000'0000) &&
+        !squareAttacked(60, BITBOARD_WHITE_PIECES) && !squareAttacked(61, BITBOARD_WHITE_PIECES) && !squareAttacked(62, BITBOARD_WHITE_PIECES))
+    {
+        uint64_t m = 1ULL << 62;
+
+        MAKE_MOVE_BLACK(60, 62, BITBOARD_KING, BITBOARD_KING);
+        moves[n_moves].flags = IS_CASTLE;
+        n_moves++;
+    }
+
+    if ((m_board.castling & CASTLE_BLACK_QUEEN_SIDE) && !(allPieces & 0x0e00'0000'0000'0000) &&
+        !squareAttacked(60, BITBOARD_WHITE_PIECES) && !squareAttacked(59, BITBOARD_WHITE_PIECES) && !squareAttacked(58, BITBOARD_WHITE_PIECES))
+    {
+        uint64_t m = 1ULL << 58;
+
+        MAKE_MOVE_BLACK(60, 58, BITBOARD_KING, BITBOARD_KING);
+        moves[n_moves].flags = IS_CASTLE;
+        n_moves++;
+    }
+
     // Pawn moves
     for (uint64_t bb = m_board.blackPawns(); bb != 0; bb &= bb - 1)
     {
     
         uint64_t pawn   = bb & -bb;
         int pawnSq      = bitScanForward(pawn);
-        uint64_t mmoves  = m_blockers.m_pawnMovesWhite[pawnSq];
-
-        mmoves &= ~(myPieces | theirPieces);
+        uint64_t push   = (pawn >> 8) & ~allPieces;
+        uint64_t mmoves = push | (((push & 0x0000'ff00'0000'0000) >> 8) & ~allPieces);
 
-        uint64_t captures = m_blockers.m_pawnAttacksWhite[pawnSq];
+        uint64_t captures = m_blockers.m_pawnAttacksBlack[pawnSq];
 
         captures &= theirPieces;
 
@@ -305,10 +531,32 @@ int BetaChess::_generate_moves_black(struct BetaMove* moves)
 
             int toSq = bitScanForward(m); // Get to square   
 
-            MAKE_MOVE_BLACK(pawnSq, toSq, BITBOARD_PAWN, BITBOARD_PAWN);
-            
-            n_moves++;
+            if (m & 0x0000'0000'0000'00ff)
+            {
+                for (int piece = BITBOARD_QUEEN; piece >= BITBOARD_KNIGHT; piece--)
+                {
+                    MAKE_MOVE_BLACK(pawnSq, toSq, BITBOARD_PAWN, piece);
+                    moves[n_moves].flags |= IS_PROMOTE;
+                    n_moves++;
+                }
+            }
+            else
+            {
+                MAKE_MOVE_BLACK(pawnSq, toSq, BITBOARD_PAWN, BITBOARD_PAWN);
+                n_moves++;
+            }
+
+        }
 
+        // En passant
+        if (m_board.ep_sq && (m_blockers.m_pawnAttacksBlack[pawnSq] & (1ULL << m_board.ep_sq)))
+        {
+            uint64_t m = 1ULL << m_board.ep_sq;
+
+            MAKE_MOVE_BLACK(pawnSq, m_board.ep_sq, BITBOARD_PAWN, BITBOARD_PAWN);
+            moves[n_moves].capture_piece = BITBOARD_PAWN;
+            moves[n_moves].flags         = IS_EN_PASSENT;
+            n_moves++;
         }
     }
 
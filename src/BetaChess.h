@@ -32,8 +32,13 @@ SOFTWARE.
 #pragma once
 
 #include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
 #include <Blockers.h>
 #include <MagicBitboards.h>
+#include <AttackTables.h>
+#include <Zobrist.h>
 
 enum BitboardPieceIdx
 {
@@ -80,6 +85,23 @@ enum BoardTurn
     TURN_BLACK = 1
 };
 
+enum BetaCastleRights
+{
+    CASTLE_WHITE_KING_SIDE  = 1,
+    CASTLE_WHITE_QUEEN_SIDE = 2,
+    CASTLE_BLACK_KING_SIDE  = 4,
+    CASTLE_BLACK_QUEEN_SIDE = 8,
+    CASTLE_ALL              = 15
+};
+
+// State which can't be recovered by replaying a move, pushed by makeMove() and popped by unmakeMove()
+struct BetaUndo
+{
+    uint64_t hash;
+    uint8_t  castling;
+    uint8_t  ep_sq;
+};
+
 struct BetaBoard
 {
 
@@ -88,6 +110,23 @@ struct BetaBoard
 
     bool     turn;
 
+    uint8_t  castling;      // BetaCastleRights still available
+    uint8_t  ep_sq;         // Square a pawn can capture onto en passant, 0 if none
+
+    // Zobrist hash, updated incrementally by makeMove() and restored by unmakeMove()
+    uint64_t m_hash;
+
+    static constexpr int kMaxPly = 256;
+
+    BetaUndo undo_stack[kMaxPly];
+    int      ply;
+
+    // Zobrist piece index for a colour and BitboardPieceIdx (see Zobrist.h)
+    static int zobristIndex(int color, int piece)
+    {
+        constexpr int kZobristIndex[8] = { 0, 0, 0, 1, 2, 3, 5, 4 };
+        return kZobristIndex[piece] + color * 6;
+    }
 
     BetaBoard()
     {
@@ -97,11 +136,68 @@ struct BetaBoard
         bitboards_piece[BITBOARD_KNIGHT]       = 0x4200'0000'0000'0042;
         bitboards_piece[BITBOARD_BISHOP]       = 0x2400'0000'0000'0024;
         bitboards_piece[BITBOARD_ROOK]         = 0x8100'0000'0000'0081;
-        bitboards_piece[BITBOARD_QUEEN]        = 0x1000'0000'0000'0010;
-        bitboards_piece[BITBOARD_KING]         = 0x0800'0000'0000'0008;
+        bitboards_piece[BITBOARD_QUEEN]        = 0x0800'0000'0000'0008;
+        bitboards_piece[BITBOARD_KING]         = 0x1000'0000'0000'0010;
         turn = TURN_WHITE;
+        castling = CASTLE_ALL;
+        ep_sq = 0;
+        ply = 0;
+        m_hash = computeHash();
     } 
 
+    uint64_t hash() const { return m_hash; }
+
+    static uint64_t castlingKey(uint8_t rights)
+    {
+        uint64_t key = 0;
+
+        for (int i = 0; i < 4; i++)
+            if (rights & (1 << i)) key ^= g_zobrist.castling[i];
+
+        return key;
+    }
+
+    static uint64_t epKey(uint8_t sq)
+    {
+        return sq ? g_zobrist.enPassantFile[sq & 7] : 0;
+    }
+
+    // Castling rights which survive a piece moving from or to a square
+    static uint8_t castlingMask(int sq)
+    {
+        switch (sq)
+        {
+            case 0:  return CASTLE_ALL & ~CASTLE_WHITE_QUEEN_SIDE;
+            case 4:  return CASTLE_ALL & ~(CASTLE_WHITE_KING_SIDE | CASTLE_WHITE_QUEEN_SIDE);
+            case 7:  return CASTLE_ALL & ~CASTLE_WHITE_KING_SIDE;
+            case 56: return CASTLE_ALL & ~CASTLE_BLACK_QUEEN_SIDE;
+            case 60: return CASTLE_ALL & ~(CASTLE_BLACK_KING_SIDE | CASTLE_BLACK_QUEEN_SIDE);
+            case 63: return CASTLE_ALL & ~CASTLE_BLACK_KING_SIDE;
+            default: return CASTLE_ALL;
+        }
+    }
+
+    uint64_t computeHash() const
+    {
+        uint64_t hash = 0;
+
+        for (int color = BITBOARD_WHITE_PIECES; color <= BITBOARD_BLACK_PIECES; color++)
+        {
+            for (int piece = BITBOARD_PAWN; piece <= BITBOARD_KING; piece++)
+            {
+                for (uint64_t bb = bitboards_color[color] & bitboards_piece[piece]; bb != 0; bb &= bb - 1)
+                    hash ^= g_zobrist.pieces[zobristIndex(color, piece)][__builtin_ctzll(bb)];
+            }
+        }
+
+        if (turn == TURN_BLACK) hash ^= g_zobrist.blackToMove;
+
+        hash ^= castlingKey(castling);
+        hash ^= epKey(ep_sq);
+
+        return hash;
+    }
+
     uint64_t* whitePieces() { return &bitboards_color[BITBOARD_WHITE_PIECES]; }
     uint64_t* blackPieces() { return &bitboards_color[BITBOARD_BLACK_PIECES]; }
     uint64_t* pawns()       { return &bitboards_piece[BITBOARD_PAWN];         }
@@ -125,12 +221,16 @@ struct BetaBoard
     uint64_t  blackKings()      { return *kings()   & *blackPieces(); }
     uint64_t  blackQueens()     { return *queens()  & *blackPieces(); }
 
+    // Move the pieces. This is its own inverse, so it is also used to take moves back.
     void _makeMove(const struct BetaMove& move)
     {
 
+        // An en passant capture takes the pawn beside the from square, on the to file
+        int capSq = (move.flags == IS_EN_PASSENT) ? ((move.sq_from & 56) | (move.sq_to & 7)) : move.sq_to;
+
         uint64_t bbFrom = 1ULL << move.sq_from;
         uint64_t bbTo   = 1ULL << move.sq_to;
-        uint64_t bbCap  = bbTo * (move.flags & IS_CAPTURE);
+        uint64_t bbCap  = (1ULL << capSq) * (move.flags & IS_CAPTURE);
  
         bitboards_color[move.bitboard_color_from]      ^= bbFrom;
         bitboards_color[move.bitboard_color_to]        ^= bbTo;
@@ -140,22 +240,61 @@ struct BetaBoard
         bitboards_piece[move.to_piece]            ^= bbTo;
         bitboards_piece[move.capture_piece]       ^= bbCap;
 
+        m_hash  ^= g_zobrist.pieces[zobristIndex(move.bitboard_color_from, move.from_piece)][move.sq_from];
+        m_hash  ^= g_zobrist.pieces[zobristIndex(move.bitboard_color_to, move.to_piece)][move.sq_to];
+        m_hash  ^= g_zobrist.pieces[zobristIndex(move.bitboard_color_capture, move.capture_piece)][capSq] & -(uint64_t)(move.flags & IS_CAPTURE);
+        m_hash  ^= g_zobrist.blackToMove;
+
+        if (move.flags == IS_CASTLE)
+        {
+            // The rook jumps over the king: h -> f file or a -> d file
+            int rookFrom = (move.sq_to > move.sq_from) ? move.sq_to + 1 : move.sq_to - 2;
+            int rookTo   = (move.sq_from + move.sq_to) / 2;
+            uint64_t bbRook = (1ULL << rookFrom) | (1ULL << rookTo);
+
+            bitboards_color[move.bitboard_color_from] ^= bbRook;
+            bitboards_piece[BITBOARD_ROOK]            ^= bbRook;
+
+            m_hash ^= g_zobrist.pieces[zobristIndex(move.bitboard_color_from, BITBOARD_ROOK)][rookFrom];
+            m_hash ^= g_zobrist.pieces[zobristIndex(move.bitboard_color_from, BITBOARD_ROOK)][rookTo];
+        }
+
         turn    ^= TURN_BLACK;
     }
 
     void makeMove(const struct BetaMove& move)
     {
+        BetaUndo& undo = undo_stack[ply++];
+
+        undo.hash     = m_hash;
+        undo.castling = castling;
+        undo.ep_sq    = ep_sq;
+
         _makeMove(move);
-        // TODO: Push other meta data, such as can castle, can e.p etc onto stack
 
+        uint8_t newCastling = castling & castlingMask(move.sq_from) & castlingMask(move.sq_to);
+
+        m_hash  ^= castlingKey(castling ^ newCastling) ^ epKey(ep_sq);
+        castling = newCastling;
+        ep_sq    = 0;
+
+        // A double pawn push allows an en passant capture on the square it passed over
+        if (move.from_piece == BITBOARD_PAWN && (move.sq_from ^ move.sq_to) == 16)
+        {
+            ep_sq   = (move.sq_from + move.sq_to) / 2;
+            m_hash ^= epKey(ep_sq);
+        }
     }
 
     void unmakeMove(const struct BetaMove& move)
     {
-
-        // TODO: Pop other meta data, such as can castle, can e.p etc off stack
         _makeMove(move);
 
+        const BetaUndo& undo = undo_stack[--ply];
+
+        m_hash   = undo.hash;
+        castling = undo.castling;
+        ep_sq    = undo.ep_sq;
     }
 
 };
@@ -165,33 +304,52 @@ class BetaChess {
 
     public:
 
-        BetaChess() { 
-        
-            m_blockers.computeBlockersAndBeyond();
-            m_magicbb = new MagicBitboards();
-            m_magicbb->computeTables(&m_blockers);
-        
+        BetaChess()  :
+            m_blockers(AttackTables::get().blockers),
+            m_magicbb(&AttackTables::get().magics)
+        {
         }
 
-        ~BetaChess() { delete m_magicbb; }
+        // With bulk counting, the last ply returns the number of legal moves without making them.
+        uint64_t perft(int depth, bool bulk = false);
 
-        uint64_t perft(int depth);
+        // Perft broken down by root move, printed as "e2e4: 600" lines
+        uint64_t perftDivide(int depth, std::vector<std::pair<std::string, uint64_t>>& divide, bool bulk = true);
 
+        static std::string moveToString(const struct BetaMove& move);
+
+        bool setBoardFromFEN(const std::string& fen);
 
         /**
+         *
+         *  Generate the legal moves in the current position.
          *
          *  \return the number of moves generated
          *
          */
-        int generate_moves(struct BetaMove* moves)
+        int generate_moves(struct BetaMove* moves);
+
+        bool squareAttacked(int sq, int byColor)
         {
-            // TODO: Get rid of branch
-            if (m_board.turn == TURN_WHITE)
-                return _generate_moves_white(moves);
-            else
-                return _generate_moves_black(moves);
+            uint64_t them = m_board.bitboards_color[byColor];
+            uint64_t occupied = *m_board.whitePieces() | *m_board.blackPieces();
+            uint64_t pawnAttacks = (byColor == BITBOARD_WHITE_PIECES) ? m_blockers.m_pawnAttacksBlack[sq] : m_blockers.m_pawnAttacksWhite[sq];
+            uint64_t diagonal = *m_board.bishops() | *m_board.queens();
+            uint64_t straight = *m_board.rooks()   | *m_board.queens();
+
+            return ((pawnAttacks & *m_board.pawns()) |
+                    (m_blockers.m_pieceMoves[PIECE_KNIGHT][sq] & *m_board.knights()) |
+                    (m_blockers.m_pieceMoves[PIECE_KING][sq] & *m_board.kings()) |
+                    (m_magicbb->bishopAttacks(sq, occupied) & diagonal) |
+                    (m_magicbb->rookAttacks(sq, occupied) & straight)) & them;
         }
 
+        const BetaBoard& board() const { return m_board; }
+
+        // The attack tables are shared by every engine instance, see AttackTables
+        const Blockers&       blockers() const { return m_blockers; }
+        const MagicBitboards* magics() const   { return m_magicbb; }
+
     private:
     
         int _generate_moves_white(struct BetaMove* moves);
@@ -205,6 +363,7 @@ class BetaChess {
     private:
 
         BetaBoard m_board;
-        Blockers  m_blockers;
-        MagicBitboards* m_magicbb;
+        // Shared, read-only lookup tables
+        const Blockers&       m_blockers;
+        const MagicBitboards* m_magicbb;
 };
@@ -312,6 +312,27 @@ void Blockers::computeBlockersAndBeyond()
         }
     }
 
+    // Compute between and line tables, used to find pins and to block checks. Both are empty
+    // unless the two squares share a rank, file or diagonal.
 
+    for (int sq1 = 0; sq1 < 64; sq1++)
+    {
+        for (int sq2 = 0; sq2 < 64; sq2++)
+        {
+            m_arrBetween[sq1][sq2] = 0;
+            m_arrLine[sq1][sq2]    = 0;
+
+            if (!(m_pieceMoves[PIECE_QUEEN][sq1] & (1ULL << sq2))) continue;
+
+            int dx = (sq2 & 7) - (sq1 & 7);
+            int dy = (sq2 >> 3) - (sq1 >> 3);
+            int step = ((dx > 0) - (dx < 0)) + 8 * ((dy > 0) - (dy < 0));
+
+            for (int sq = sq1 + step; sq != sq2; sq += step)
+                m_arrBetween[sq1][sq2] |= 1ULL << sq;
+
+            m_arrLine[sq1][sq2] = m_arrBetween[sq1][sq2] | (1ULL << sq1) | (1ULL << sq2) | m_arrBehind[sq1][sq2] | m_arrBehind[sq2][sq1];
+        }
+    }
 
 }
@@ -43,7 +43,7 @@ class Blockers
 
         void computeBlockersAndBeyond();
 
-        uint64_t pieceAttacks(enum SimplePieceTypes  piece, int sq, uint64_t occupied)
+        uint64_t pieceAttacks(enum SimplePieceTypes  piece, int sq, uint64_t occupied) const
         {
             // First, get piece moves
             uint64_t moves = m_pieceMoves[piece][sq];
@@ -61,6 +61,8 @@ class Blockers
         std::uint64_t m_pieceMoves[6][64];
         std::uint64_t m_arrBlockersAndBeyond[6][64];
         std::uint64_t m_arrBehind[64][64];
+        std::uint64_t m_arrBetween[64][64];     // Squares strictly between two squares on a line
+        std::uint64_t m_arrLine[64][64];        // The whole line through two squares
         std::uint64_t m_pawnMovesWhite[64];
         std::uint64_t m_pawnMovesBlack[64];
         std::uint64_t m_pawnAttacksWhite[64];
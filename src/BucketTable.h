@@ -0,0 +1,89 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+BucketTable.h: Power of two array of hash buckets shared by the hash tables
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+
+// Storage for the transposition table and the perft cache. Both are arrays of cache line
+// sized buckets, each holding Bucket::kEntries lockless slots of a key XOR data word and a
+// data word. The number of buckets is a power of two so a key is indexed with a mask.
+
+template <typename Bucket>
+class BucketTable {
+
+    public:
+
+        BucketTable()  :
+            m_nBuckets(0),
+            m_mask(0)
+        {
+        }
+
+        // Round down to a power of two number of buckets that fits in the given size
+        void resize(std::size_t megabytes)
+        {
+            std::size_t nBuckets = 1;
+
+            while (nBuckets * 2 * sizeof(Bucket) <= megabytes * 1024 * 1024)
+                nBuckets *= 2;
+
+            m_buckets.reset(new Bucket[nBuckets]());
+            m_nBuckets = nBuckets;
+            m_mask = nBuckets - 1;
+        }
+
+        void clear()
+        {
+            for (std::size_t i = 0; i < m_nBuckets; i++)
+            {
+                for (int j = 0; j < Bucket::kEntries; j++)
+                {
+                    m_buckets[i].slots[j].keyXorData.store(0, std::memory_order_relaxed);
+                    m_buckets[i].slots[j].data.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        Bucket&       bucket(uint64_t key)       { return m_buckets[key & m_mask]; }
+        const Bucket& bucket(uint64_t key) const { return m_buckets[key & m_mask]; }
+
+        std::size_t sizeInBytes() const { return m_nBuckets * sizeof(Bucket); }
+
+    private:
+
+        std::unique_ptr<Bucket[]> m_buckets;
+        std::size_t   m_nBuckets;
+        std::uint64_t m_mask;
+};
@@ -31,11 +31,17 @@ SOFTWARE.
 */
 
 #include "Chess.h"
+#include "MovePicker.h"
 #include <cstdio>
+#include <cstring>
 //#include <iostream>
 #include <vector>
 #include <chrono>
 #include <algorithm>
+#include <sstream>
+#include <thread>
+#include <cmath>
+#include <array>
 #include <MagicBitboards.h>
 
 const std::vector<std::pair<int, int>> knightMoves = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
@@ -184,20 +190,59 @@ const double kingPositionWeightsEG[64] = {
     -53, -34, -21, -11, -28, -14, -24, -43
 };
 
-#define INFINITY 1e10
+// Bigger than any score, including mates
+static constexpr double kInfinity = 1e10;
 
 Chess::Chess()  :
     m_totalCheckTestMicroseconds(0),
     m_totalGenerateMoveMicroseconds(0),
     m_totalEvaluateMicroseconds(0),
-    m_totalGenLegalMicroseconds(0)
+    m_totalGenLegalMicroseconds(0),
+    m_tt(std::make_shared<TranspositionTable>()),
+    m_useTranspositionTable(true),
+    m_useQuiescence(true),
+    m_usePVS(true),
+    m_useNullMove(true),
+    m_nullMoveTries(0),
+    m_nullMoveCutoffs(0),
+    m_useLMR(true),
+    m_lmrReductions(0),
+    m_lmrReSearches(0),
+    m_useFutility(true),
+    m_futilityPrunes(0),
+    m_reverseFutilityPrunes(0),
+    m_razorPrunes(0),
+    m_aspirationWindow(0.25),
+    m_perftCache(nullptr),
+    m_ttProbes(0),
+    m_ttHits(0),
+    m_ttStores(0),
+    m_followPV(false),
+    m_searchDeadline(std::chrono::steady_clock::time_point::max()),
+    m_stopSearch(false),
+    m_completedDepth(0),
+    m_searchNodes(0),
+    m_qsearchNodes(0),
+    m_searchThreads(1),
+    m_stopHelpers(nullptr)
 {
-    computeBlockersAndBeyond();
-    
-    m_blockers.computeBlockersAndBeyond();
-    
-    m_magicbb = new MagicBitboards();
-    m_magicbb->computeTables(&m_blockers);
+    const AttackTables& tables = AttackTables::get();
+
+    m_pieceMoves            = tables.blockers.m_pieceMoves;
+    m_arrBlockersAndBeyond  = tables.blockers.m_arrBlockersAndBeyond;
+    m_arrBehind             = tables.blockers.m_arrBehind;
+    m_arrBetween            = tables.blockers.m_arrBetween;
+    m_arrLine               = tables.blockers.m_arrLine;
+    m_pawnMovesWhite        = tables.blockers.m_pawnMovesWhite;
+    m_pawnMovesBlack        = tables.blockers.m_pawnMovesBlack;
+    m_pawnAttacksWhite      = tables.blockers.m_pawnAttacksWhite;
+    m_pawnAttacksBlack      = tables.blockers.m_pawnAttacksBlack;
+    m_magicbb               = &tables.magics;
+
+    clearKillers();
+    std::memset(m_history, 0, sizeof(m_history));
+    std::memset(m_pvLength, 0, sizeof(m_pvLength));
+
     resetBoard();
     printBoard(m_board);
 }
@@ -230,8 +275,127 @@ void Chess::resetBoard()
     m_board.m_blackARookHasMoved = false;
     m_board.m_blackHRookHasMoved = false;
 
+    m_board.rehash();
+
+    m_board.m_legalMoves.clear();
+    getLegalMovesForBoardAsVector(m_board, m_board.m_legalMoves);
+}
+
+// Set up the board from a FEN string: https://www.chessprogramming.org/Forsyth-Edwards_Notation
+// The half move clock and move number are ignored. If the string can't be parsed, the board is
+// reset to the starting position and false is returned.
+bool Chess::setBoardFromFEN(const std::string& fen)
+{
+    std::istringstream ss(fen);
+    std::string placement, side, castling, ep;
+
+    ss >> placement >> side >> castling >> ep;
+
+    if (ss.fail())
+    {
+        resetBoard();
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        *m_board.pawns[i]   = 0;
+        *m_board.knights[i] = 0;
+        *m_board.bishops[i] = 0;
+        *m_board.rooks[i]   = 0;
+        *m_board.queens[i]  = 0;
+        *m_board.kings[i]   = 0;
+    }
+
+    int x = A_FILE;
+    int y = EIGHTH_RANK;
+
+    for (char c : placement)
+    {
+        if (c == '/')
+        {
+            x = A_FILE;
+            y--;
+            continue;
+        }
+
+        if (c >= '1' && c <= '8')
+        {
+            x += c - '0';
+            continue;
+        }
+
+        uint64_t* bb = nullptr;
+
+        switch (c)
+        {
+            case 'P': bb = &m_board.whitePawnsBoard; break;
+            case 'N': bb = &m_board.whiteKnightsBoard; break;
+            case 'B': bb = &m_board.whiteBishopsBoard; break;
+            case 'R': bb = &m_board.whiteRooksBoard; break;
+            case 'Q': bb = &m_board.whiteQueensBoard; break;
+            case 'K': bb = &m_board.whiteKingsBoard; break;
+            case 'p': bb = &m_board.blackPawnsBoard; break;
+            case 'n': bb = &m_board.blackKnightsBoard; break;
+            case 'b': bb = &m_board.blackBishopsBoard; break;
+            case 'r': bb = &m_board.blackRooksBoard; break;
+            case 'q': bb = &m_board.blackQueensBoard; break;
+            case 'k': bb = &m_board.blackKingsBoard; break;
+        }
+
+        if (bb == nullptr || !IS_IN_BOARD(x, y))
+        {
+            resetBoard();
+            return false;
+        }
+
+        *bb |= COORD_TO_BIT(x, y);
+        x++;
+    }
+
+    m_board.m_isWhitesTurn = (side == "w");
+
+    m_board.m_whiteKingHasMoved  = true;
+    m_board.m_blackKingHasMoved  = true;
+    m_board.m_whiteARookHasMoved = true;
+    m_board.m_whiteHRookHasMoved = true;
+    m_board.m_blackARookHasMoved = true;
+    m_board.m_blackHRookHasMoved = true;
+
+    for (char c : castling)
+    {
+        switch (c)
+        {
+            case 'K':
+                m_board.m_whiteKingHasMoved  = false;
+                m_board.m_whiteHRookHasMoved = false;
+                break;
+            case 'Q':
+                m_board.m_whiteKingHasMoved  = false;
+                m_board.m_whiteARookHasMoved = false;
+                break;
+            case 'k':
+                m_board.m_blackKingHasMoved  = false;
+                m_board.m_blackHRookHasMoved = false;
+                break;
+            case 'q':
+                m_board.m_blackKingHasMoved  = false;
+                m_board.m_blackARookHasMoved = false;
+                break;
+        }
+    }
+
+    m_board.m_can_en_passant_file = INVALID_FILE;
+
+    if (ep.size() == 2 && ep[0] >= 'a' && ep[0] <= 'h')
+        m_board.m_can_en_passant_file = ep[0] - 'a';
+
+    m_board.rehash();
+
     m_board.m_legalMoves.clear();
     getLegalMovesForBoardAsVector(m_board, m_board.m_legalMoves);
+
+    return true;
 }
 
 void Chess::getLegalMovesForSquare(int x, int y, uint64_t &moveSquares)
@@ -659,6 +823,9 @@ void Chess::removePieceFromSquare(ChessBoard& board, enum PieceTypes type, int x
 {
     uint64_t sq   = COORD_TO_BIT(x, y);
 
+    if ((type != NO_PIECE) && (getPieceForSquare(board, x, y) == type))
+        board.m_hash ^= g_zobrist.pieces[__builtin_ctz(type)][x + y*8];
+
     switch (type)
     {
         case WHITE_PAWN:
@@ -707,6 +874,9 @@ void Chess::addPieceToSquare(ChessBoard& board, enum PieceTypes type, int x, int
 
     uint64_t sq   = COORD_TO_BIT(x, y);
 
+    if ((type != NO_PIECE) && (getPieceForSquare(board, x, y) != type))
+        board.m_hash ^= g_zobrist.pieces[__builtin_ctz(type)][x + y*8];
+
     switch (type)
     {
         case WHITE_PAWN:
@@ -802,20 +972,20 @@ void Chess::makeMoveForBoard(ChessBoard& board, int x1, int y1, int x2, int y2,
 
      // If this piece is a king, flag that the king has moved
     if (start_piece == WHITE_KING)
-        board.m_whiteKingHasMoved = true;
+        board.setCastleFlag(board.m_whiteKingHasMoved, ZOBRIST_WHITE_KING_MOVED);
     else if (start_piece == BLACK_KING)
-        board.m_blackKingHasMoved = true;
+        board.setCastleFlag(board.m_blackKingHasMoved, ZOBRIST_BLACK_KING_MOVED);
 
     // Check if rooks have moved (disable castle)
     if (start_piece == WHITE_ROOK)
     {
-        if (x1 == A_FILE) board.m_whiteARookHasMoved = true;
-        else if (x1 == H_FILE) board.m_whiteHRookHasMoved = true;
+        if (x1 == A_FILE) board.setCastleFlag(board.m_whiteARookHasMoved, ZOBRIST_WHITE_A_ROOK_MOVED);
+        else if (x1 == H_FILE) board.setCastleFlag(board.m_whiteHRookHasMoved, ZOBRIST_WHITE_H_ROOK_MOVED);
     }
     else if (start_piece == BLACK_ROOK)
     {
-        if (x1 == A_FILE) board.m_blackARookHasMoved = true;
-        else if (x1 == H_FILE) board.m_blackHRookHasMoved = true;
+        if (x1 == A_FILE) board.setCastleFlag(board.m_blackARookHasMoved, ZOBRIST_BLACK_A_ROOK_MOVED);
+        else if (x1 == H_FILE) board.setCastleFlag(board.m_blackHRookHasMoved, ZOBRIST_BLACK_H_ROOK_MOVED);
     } 
 
     // Check for castling
@@ -828,7 +998,7 @@ void Chess::makeMoveForBoard(ChessBoard& board, int x1, int y1, int x2, int y2,
             // Castle King side
             removePieceFromSquare(board, WHITE_ROOK, H_FILE, FIRST_RANK);
             addPieceToSquare(board, WHITE_ROOK, F_FILE, FIRST_RANK);
-            board.m_whiteHRookHasMoved = true;
+            board.setCastleFlag(board.m_whiteHRookHasMoved, ZOBRIST_WHITE_H_ROOK_MOVED);
             castle_kings_side = true;
         }
         else if (x2 == C_FILE)
@@ -836,7 +1006,7 @@ void Chess::makeMoveForBoard(ChessBoard& board, int x1, int y1, int x2, int y2,
             // Castle Queen side
             removePieceFromSquare(board, WHITE_ROOK, A_FILE, FIRST_RANK);
             addPieceToSquare(board, WHITE_ROOK, D_FILE, FIRST_RANK);
-            board.m_whiteARookHasMoved = true;
+            board.setCastleFlag(board.m_whiteARookHasMoved, ZOBRIST_WHITE_A_ROOK_MOVED);
             castle_queens_side = true;
         }
 
@@ -849,7 +1019,7 @@ void Chess::makeMoveForBoard(ChessBoard& board, int x1, int y1, int x2, int y2,
             // Castle King side
             removePieceFromSquare(board, BLACK_ROOK, H_FILE, EIGHTH_RANK);
             addPieceToSquare(board, BLACK_ROOK, F_FILE, EIGHTH_RANK);
-            board.m_blackHRookHasMoved = true;
+            board.setCastleFlag(board.m_blackHRookHasMoved, ZOBRIST_BLACK_H_ROOK_MOVED);
             castle_kings_side = true;
         }
         else if (x2 == C_FILE)
@@ -857,7 +1027,7 @@ void Chess::makeMoveForBoard(ChessBoard& board, int x1, int y1, int x2, int y2,
             // Castle Queen side
             removePieceFromSquare(board, BLACK_ROOK, A_FILE, EIGHTH_RANK);
             addPieceToSquare(board, BLACK_ROOK, D_FILE, EIGHTH_RANK);
-            board.m_blackARookHasMoved = true;
+            board.setCastleFlag(board.m_blackARookHasMoved, ZOBRIST_BLACK_A_ROOK_MOVED);
             castle_queens_side = true;
         }
 
@@ -912,7 +1082,9 @@ void Chess::makeMoveForBoard(ChessBoard& board, int x1, int y1, int x2, int y2,
     }
 
     
-    board.m_isWhitesTurn = !board.m_isWhitesTurn;
+    board.nextTurn();
+
+    CHECK_ZOBRIST(board);
 
     // Compute legal moves for board
     if (recompute_legal)
@@ -1101,7 +1273,7 @@ uint64_t Chess::movesForPlayer(const ChessBoard& board, bool white)
     uint64_t legalMoves = 0;
 
     ChessBoard b = board;
-    b.m_isWhitesTurn = white;
+    if (b.m_isWhitesTurn != white) b.nextTurn();
 
     for (int x = 0; x < 8; x++)
     {
@@ -1351,7 +1523,7 @@ double Chess::minimaxAlphaBeta(const ChessBoard& board, bool white, ChessMove& m
 
     if (maximizing)
     {
-        double score = -INFINITY;
+        double score = -kInfinity;
 
         for (const auto & m : board.m_legalMoves)
         {
@@ -1379,7 +1551,7 @@ double Chess::minimaxAlphaBeta(const ChessBoard& board, bool white, ChessMove& m
     }
     else
     {
-        double score = INFINITY;
+        double score = kInfinity;
         for (const auto & m : board.m_legalMoves)
         {
             ChessBoard b = board;
@@ -1411,326 +1583,243 @@ double Chess::minimaxAlphaBeta(const ChessBoard& board, bool white, ChessMove& m
 
 
 
-void Chess::getBestMove(int& x1, int& y1, int& x2, int& y2, enum PromotionType& promote)
+int Chess::timeBudgetMs()
 {
+    if (m_searchLimits.moveTimeMs > 0)
+        return m_searchLimits.moveTimeMs;
 
-    ChessMove m;
-
-    uint64_t npos = 0;
-
-    std::chrono::time_point<std::chrono::high_resolution_clock> oldTime = std::chrono::high_resolution_clock::now();
- 
-    double maxScore = minimaxAlphaBetaFaster(m_board, m_board.m_isWhitesTurn, m, true, 6, npos, -INFINITY, INFINITY);
-
-    auto msecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - oldTime);
-    
-    printf("Number of positions: %ld (%1.3f secs) = %1.3f KNps\n", npos, msecs.count() / 1'000'000.0, npos / 1000.0 / (msecs.count() / 1'000'000.0));
-    printf("check test: %1.3f eval: %1.3f gen: %1.3f gen2: %1.3f \n", m_totalCheckTestMicroseconds / 1'000'000.0, 
-                m_totalEvaluateMicroseconds / 1'000'000.0, m_totalGenerateMoveMicroseconds / 1'000'000.0, 
-                m_totalGenLegalMicroseconds / 1'000'000.0); 
-
-    m_totalCheckTestMicroseconds    = 0;
-    m_totalGenerateMoveMicroseconds = 0;
-    m_totalEvaluateMicroseconds     = 0;
-    m_totalGenLegalMicroseconds     = 0;
-
-    printf("Max score: %f\n", maxScore);
-    printf("Best move is: ");
-    printPrettyMove(m_board, m);
-    printf("\n");
+    // Spread the remaining time over the rest of the game, assuming around 30 more moves,
+    // and keep a safety margin so we never lose on time
+    int budget = m_searchLimits.timeLeftMs / 30 + m_searchLimits.incrementMs * 3 / 4;
 
-    x1 = m.x1;
-    x2 = m.x2;
-    y1 = m.y1;
-    y2 = m.y2;
-    promote = m.promote;
+    budget = std::min(budget, m_searchLimits.timeLeftMs / 2);
+    budget = std::min(budget, m_searchLimits.timeLeftMs - 50);
 
+    return std::max(budget, 1);
 }
 
-void Chess::computeBlockersAndBeyond()
+// Iterative deepening: search to depth firstDepth, firstDepth + 1, ... until we run out of time.
+// The main thread always completes its first iteration so that there is a move to play, and
+// doesn't start an iteration it is unlikely to finish. Helper threads keep going until told to stop.
+double Chess::searchIterations(ChessMove& bestMove, int firstDepth, int budget, 
+                               std::chrono::steady_clock::time_point startTime, bool mainThread)
 {
-    // Compute piece moves and occupancy mask
-
-    // Pawns - set to zero
-    for (int sq = 0; sq < 64; sq++)
-    {
-        m_pieceMoves[PIECE_PAWN][sq] = 0;
-        m_arrBlockersAndBeyond[PIECE_PAWN][sq] = 0;
-    }
-
-    // Now compute specialised pawn arrays
-
-    for (int sq = 0; sq < 64; sq++)
-    {
-        int x1 = sq & 7;
-        int y1 = sq >> 3;
-
-        m_pawnMovesWhite[sq] = 0;
-        m_pawnAttacksWhite[sq] = 0;
-
-        if (y1 == EIGHTH_RANK) break;
-
-        m_pawnMovesWhite[sq] |= COORD_TO_BIT(x1, y1 + 1);
-
-        if (IS_IN_BOARD(x1 - 1, y1 + 1))
-            m_pawnAttacksWhite[sq] |= COORD_TO_BIT(x1 - 1, y1 + 1);
-
-        if (IS_IN_BOARD(x1 + 1, y1 + 1))
-            m_pawnAttacksWhite[sq] |= COORD_TO_BIT(x1 + 1, y1 + 1);
-
-        if (y1 != SECOND_RANK) continue;
-
-        m_pawnMovesWhite[sq] |= COORD_TO_BIT(x1, y1 + 2);
+    double bestScore = 0.0;
+
+    m_stopSearch = false;
+    m_completedDepth = 0;
+    m_searchNodes = 0;
+    m_qsearchNodes = 0;
+    m_nullMoveTries = 0;
+    m_nullMoveCutoffs = 0;
+    m_futilityPrunes = 0;
+    m_reverseFutilityPrunes = 0;
+    m_razorPrunes = 0;
+    m_principalVariation.clear();
+
+    if (mainThread)
+        m_searchDeadline = std::chrono::steady_clock::time_point::max();
+    else
+        m_searchDeadline = startTime + std::chrono::milliseconds(budget);
 
-    }
+    uint64_t lastIterationPos = 0;
 
-    for (int sq = 63; sq >= 0; sq--)
+    for (int depth = firstDepth; depth <= m_searchLimits.maxDepth; depth++)
     {
-        int x1 = sq & 7;
-        int y1 = sq >> 3;
-
-        m_pawnMovesBlack[sq] = 0;
-        m_pawnAttacksBlack[sq] = 0;
+        ChessMove iterationMove;
+        uint64_t iterationPos = 0;
+        double score;
 
-        if (y1 == FIRST_RANK) break;
+        m_lmrReductions = 0;
+        m_lmrReSearches = 0;
 
-        m_pawnMovesBlack[sq] |= COORD_TO_BIT(x1, y1 - 1);
+        if (m_usePVS)
+        {
+            // Aspiration windows: https://www.chessprogramming.org/Aspiration_Windows
+            // The score rarely moves far between iterations, so search a narrow window around the
+            // last one first. If the score falls outside it, widen that side and search again.
+            double delta = (depth > firstDepth && m_aspirationWindow > 0.0) ? m_aspirationWindow : kInfinity;
+            double alpha = std::max(bestScore - delta, -kInfinity);
+            double beta  = std::min(bestScore + delta, kInfinity);
+
+            while (true)
+            {
+                m_followPV = true;
+                score = principalVariationSearch(m_board, iterationMove, depth, iterationPos, alpha, beta);
 
-        if (IS_IN_BOARD(x1 - 1, y1 - 1))
-            m_pawnAttacksBlack[sq] |= COORD_TO_BIT(x1 - 1, y1 - 1);
+                if (m_stopSearch) break;
 
-        if (IS_IN_BOARD(x1 + 1, y1 - 1))
-            m_pawnAttacksBlack[sq] |= COORD_TO_BIT(x1 + 1, y1 - 1);
+                if (score <= alpha && alpha > -kInfinity)
+                    alpha = std::max(alpha - delta, -kInfinity);
+                else if (score >= beta && beta < kInfinity)
+                    beta = std::min(beta + delta, kInfinity);
+                else
+                    break;
 
-        if (y1 != SEVENTH_RANK) continue;
+                // Mate scores are far outside any window, so give up on it after a few tries
+                delta = (delta >= 4.0) ? kInfinity : delta * 2.0;
+            }
+        }
+        else
+            score = minimaxAlphaBetaFaster(m_board, m_board.m_isWhitesTurn, iterationMove, true, depth, iterationPos, -kInfinity, kInfinity);
 
-        m_pawnMovesBlack[sq] |= COORD_TO_BIT(x1, y1 - 2);
+        m_searchNodes += iterationPos;
 
-    }
- 
-    // Knights
+        if (m_stopSearch) break;
 
-    for (int sq = 0; sq < 64; sq++)
-    {
-        int x1 = sq & 7;
-        int y1 = sq >> 3;
+        bestMove = iterationMove;
+        bestScore = score;
+        m_completedDepth = depth;
 
-        m_pieceMoves[PIECE_KNIGHT][sq] = 0;
-        m_arrBlockersAndBeyond[PIECE_KNIGHT][sq] = 0;
-        
-        for (const auto& m : knightMoves)
+        if (m_usePVS)
         {
-
-            int x2 = x1 + m.first;
-            int y2 = y1 + m.second;
-            
-            if (!IS_IN_BOARD(x2, y2)) continue;
-
-            m_pieceMoves[PIECE_KNIGHT][sq] |= COORD_TO_BIT(x2, y2);
+            m_principalVariation.assign(&m_pvTable[0][0], &m_pvTable[0][m_pvLength[0]]);
+            extendPVFromTT(depth);
         }
 
-    }
-
-    // Bishops
-
-    for (int sq = 0; sq < 64; sq++)
-    {
-        int x1 = sq & 7;
-        int y1 = sq >> 3;
-
-        m_pieceMoves[PIECE_BISHOP][sq] = 0;
-        m_arrBlockersAndBeyond[PIECE_BISHOP][sq] = 0;
+        // Effective branching factor: how many times more nodes this iteration took than the last
+        double ebf = lastIterationPos ? (double)iterationPos / lastIterationPos : 0.0;
+        lastIterationPos = iterationPos;
 
-        for (const auto& m : bishopMoves)
-        {
+        if (!mainThread) continue;
 
-            for (int i = 1; i < 8; i++)
-            {
-                int x2 = x1 + i*m.first;
-                int y2 = y1 + i*m.second;
-                int x3 = x1 + (i+1)*m.first;
-                int y3 = y1 + (i+1)*m.second;
+        auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
 
-                if (IS_IN_BOARD(x3, y3)) m_arrBlockersAndBeyond[PIECE_BISHOP][sq] 
-                        |= COORD_TO_BIT(x2, y2); 
-                if (!IS_IN_BOARD(x2, y2)) break;
+        printf("Depth %d: score %f nodes %ld ebf %1.2f lmr %ld (%ld re-searched) time %1.3f secs best move ", depth, score,
+                iterationPos, ebf, m_lmrReductions, m_lmrReSearches, elapsedMs / 1000.0);
+        printPrettyMove(m_board, bestMove);
+        if (!m_principalVariation.empty()) printf(" pv %s", pvToString().c_str());
+        printf("\n");
 
-                m_pieceMoves[PIECE_BISHOP][sq] |= COORD_TO_BIT(x2, y2);
-            }
-        }
+        // The next iteration will take several times longer than this one, so don't start it
+        // unless there is a good chance of completing it
+        if (elapsedMs * 2 >= budget) break;
 
+        m_searchDeadline = startTime + std::chrono::milliseconds(budget);
     }
 
-    // Rooks
-
-    for (int sq = 0; sq < 64; sq++)
-    {
-        int x1 = sq & 7;
-        int y1 = sq >> 3;
+    m_stopSearch = false;
+    m_searchDeadline = std::chrono::steady_clock::time_point::max();
 
-        m_pieceMoves[PIECE_ROOK][sq] = 0;
-        m_arrBlockersAndBeyond[PIECE_ROOK][sq] = 0;
+    return bestScore;
+}
 
-        for (const auto& m : rookMoves)
-        {
+void Chess::getBestMove(int& x1, int& y1, int& x2, int& y2, enum PromotionType& promote)
+{
 
-            for (int i = 1; i < 8; i++)
-            {
-                int x2 = x1 + i*m.first;
-                int y2 = y1 + i*m.second;
-                int x3 = x1 + (i+1)*m.first;
-                int y3 = y1 + (i+1)*m.second;
+    ChessMove m;
 
-                if (IS_IN_BOARD(x3, y3)) m_arrBlockersAndBeyond[PIECE_ROOK][sq] 
-                        |= COORD_TO_BIT(x2, y2); 
- 
-                if (!IS_IN_BOARD(x2, y2)) break;
+    std::chrono::time_point<std::chrono::high_resolution_clock> oldTime = std::chrono::high_resolution_clock::now();
 
-                m_pieceMoves[PIECE_ROOK][sq] |= COORD_TO_BIT(x2, y2);
-            }
-        }
+    m_tt->newSearch();
 
-    }
+    // Killers are specific to the positions of the last search, history is still a useful guide
+    clearKillers();
+    ageQuietHistory();
 
-    // Queens
-    for (int sq = 0; sq < 64; sq++)
-    {
-        int x1 = sq & 7;
-        int y1 = sq >> 3;
+    int budget = timeBudgetMs();
+    auto startTime = std::chrono::steady_clock::now();
 
-        m_pieceMoves[PIECE_QUEEN][sq] = 0;
-        m_arrBlockersAndBeyond[PIECE_QUEEN][sq] = 0;
+    // Lazy SMP: https://www.chessprogramming.org/Lazy_SMP
+    // Helper threads run the same search on their own copy of the engine, so each has a private
+    // board and counters and only the transposition table is shared. The main thread picks up
+    // their work through the table. Odd numbered helpers start a ply deeper so that the threads
+    // don't all search the same tree in lock step.
 
-        for (const auto& m : queenMoves)
-        {
+    std::atomic<bool> stopHelpers(false);
+    std::vector<std::unique_ptr<Chess>> helpers;
+    std::vector<std::thread> threads;
 
-            for (int i = 1; i < 8; i++)
-            {
-                int x2 = x1 + i*m.first;
-                int y2 = y1 + i*m.second;
-                int x3 = x1 + (i+1)*m.first;
-                int y3 = y1 + (i+1)*m.second;
+    for (int i = 1; i < m_searchThreads; i++)
+    {
+        helpers.emplace_back(std::make_unique<Chess>(*this));
 
-                if (IS_IN_BOARD(x3, y3)) m_arrBlockersAndBeyond[PIECE_QUEEN][sq] 
-                        |= COORD_TO_BIT(x2, y2); 
- 
-                if (!IS_IN_BOARD(x2, y2)) break;
+        Chess* helper = helpers.back().get();
 
-                m_pieceMoves[PIECE_QUEEN][sq] |= COORD_TO_BIT(x2, y2);
-            }
-        }
+        helper->m_stopHelpers = &stopHelpers;
 
+        threads.emplace_back([helper, i, budget, startTime] {
+            ChessMove helperMove;
+            helper->searchIterations(helperMove, 1 + (i & 1), budget, startTime, false);
+        });
     }
 
-    // Kings
-    for (int sq = 0; sq < 64; sq++)
-    {
-        int x1 = sq & 7;
-        int y1 = sq >> 3;
-
-        m_pieceMoves[PIECE_KING][sq] = 0;
-        m_arrBlockersAndBeyond[PIECE_KING][sq] = 0;
-        
-        for (const auto& m : kingMoves)
-        {
+    double maxScore = searchIterations(m, 1, budget, startTime, true);
 
-            int x2 = x1 + m.first;
-            int y2 = y1 + m.second;
-            
-            if (!IS_IN_BOARD(x2, y2)) continue;
-
-            m_pieceMoves[PIECE_KING][sq] |= COORD_TO_BIT(x2, y2);
-        }
+    stopHelpers = true;
 
-    }
+    for (auto& t : threads)
+        t.join();
 
-    // Compute behind table
+    uint64_t npos = m_searchNodes;
 
-    for (int sq1 = 0; sq1 < 64; sq1++)
+    for (auto& h : helpers)
     {
-        int x1 = sq1 & 7;
-        int y1 = sq1 >> 3;
+        npos       += h->m_searchNodes;
+        m_qsearchNodes += h->m_qsearchNodes;
+        m_nullMoveTries += h->m_nullMoveTries;
+        m_nullMoveCutoffs += h->m_nullMoveCutoffs;
+        m_futilityPrunes += h->m_futilityPrunes;
+        m_reverseFutilityPrunes += h->m_reverseFutilityPrunes;
+        m_razorPrunes += h->m_razorPrunes;
+        m_ttProbes += h->m_ttProbes;
+        m_ttHits   += h->m_ttHits;
+        m_ttStores += h->m_ttStores;
+    }
 
-        for (int sq2 = 0; sq2 < 64; sq2++)
-        {
+    m_searchNodes = npos;
 
-            int x2 = sq2 & 7;
-            int y2 = sq2 >> 3;
+    auto msecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - oldTime);
+    
+    printf("Number of positions: %ld (%1.3f secs) = %1.3f KNps (%d threads)\n", npos, msecs.count() / 1'000'000.0, npos / 1000.0 / (msecs.count() / 1'000'000.0), m_searchThreads);
+    printf("check test: %1.3f eval: %1.3f gen: %1.3f gen2: %1.3f \n", m_totalCheckTestMicroseconds / 1'000'000.0, 
+                m_totalEvaluateMicroseconds / 1'000'000.0, m_totalGenerateMoveMicroseconds / 1'000'000.0, 
+                m_totalGenLegalMicroseconds / 1'000'000.0); 
+    printf("TT probes: %ld hits: %ld stores: %ld\n", m_ttProbes, m_ttHits, m_ttStores);
+    printf("Quiescence nodes: %ld (%1.2f per main search node)\n", m_qsearchNodes, npos ? (double)m_qsearchNodes / npos : 0.0);
+    printf("Null moves: %ld tried, %ld cutoffs\n", m_nullMoveTries, m_nullMoveCutoffs);
+    printf("Pruned: %ld futile moves, %ld reverse futility nodes, %ld razored nodes\n", m_futilityPrunes,
+            m_reverseFutilityPrunes, m_razorPrunes);
 
-            // We are standing on sq1. Fire a ray toward sq2, if we can. compute squares behind sq2.
-            
-            int dx = x2 - x1;
-            int dy = y2 - y1;
+    m_totalCheckTestMicroseconds    = 0;
+    m_totalGenerateMoveMicroseconds = 0;
+    m_totalEvaluateMicroseconds     = 0;
+    m_totalGenLegalMicroseconds     = 0;
 
-            if ((dx > 0) && (dy > 0) && (dx == dy))
-            {
-                // Gradient = (1, 1)
-                dx = 1;
-                dy = 1;
-            }
-            else if ((dx < 0) && (dy > 0) && (-dx == dy))
-            {
-                // Gradient = (-1, 1)
-                dx = -1;
-                dy = 1;
-            }
-            else if ((dx < 0) && (dy < 0) && (dx == dy))
-            {
-                // Gradient = (-1, -1)
-                dx = -1;
-                dy = -1;
-            }
-            else if ((dx > 0) && (dy < 0) && (dx == -dy))
-            {
-                // Gradient = (1, -1)
-                dx = 1;
-                dy = -1;
-            }
-            else if (dx == 0)
-            {
-                dy = (dy > 0) ? 1 : -1;
-            }
-            else if (dy == 0)
-            {
-                dx = (dx > 0) ? 1 : -1;
-            }
-            else
-            {
-                dx = 0;
-                dy = 0;
-            }
+    m_ttProbes = 0;
+    m_ttHits   = 0;
+    m_ttStores = 0;
 
-            m_arrBehind[sq1][sq2] = 0;
-            
-            if (dx || dy)
-            {
-                do {
-                    x2 += dx;
-                    y2 += dy;
+    printf("Max score: %f (depth %d)\n", maxScore, m_completedDepth);
+    printf("Best move is: ");
+    printPrettyMove(m_board, m);
+    printf("\n");
 
-                    if (IS_IN_BOARD(x2, y2))
-                        m_arrBehind[sq1][sq2] |= COORD_TO_BIT(x2, y2);
-                } while (IS_IN_BOARD(x2, y2));
-            }
-        }
-    }
+    x1 = m.x1;
+    x2 = m.x2;
+    y1 = m.y1;
+    y2 = m.y2;
+    promote = m.promote;
 
 }
 
-double Chess::minimaxAlphaBetaFaster(ChessBoard& board, bool white, ChessMove& move, bool maximizing, int depth, uint64_t& npos, double alpha, double beta)
+double Chess::minimaxAlphaBetaFaster(ChessBoard& board, bool white, ChessMove& move, bool maximizing, int depth, uint64_t& npos, double alpha, double beta, int ply)
 {
-    bool isRoot = npos == 0;
-
-    bool oppKingDead = false;
+    bool isRoot = ply == 0;
 
     if (depth == 0)
     {
         double whiteScore = 0.0;
         double blackScore = 0.0;
 
+        npos ++;
+
+        if (m_useQuiescence)
+            return quiescence(board, white, maximizing, alpha, beta, ply);
+
         evalBoardFaster(board, whiteScore, blackScore);
 
-        npos ++;
+        if ((npos & 1023) == 0) checkSearchTime();
 
         if (white)
         {
@@ -1742,41 +1831,96 @@ double Chess::minimaxAlphaBetaFaster(ChessBoard& board, bool white, ChessMove& m
         }
     }
 
+    // Probe the transposition table. Entries are stored from the point of view of the side
+    // to move, which is the maximizing player at maximizing nodes and the opponent otherwise.
+
+    uint64_t hash = 0;
+    double alphaOrig = alpha;
+    double betaOrig  = beta;
+    uint16_t bestMove = 0;
+    uint16_t ttMove = 0;
+
+    if (m_useTranspositionTable)
+    {
+        hash = board.hash();
+
+        TTEntry entry;
+        bool hit = false;
+
+        m_ttProbes++;
+        hit = m_tt->probe(hash, entry);
+        if (hit) m_ttHits++;
+
+        // Try the stored best move first, even when the entry is too shallow to use
+        if (hit) ttMove = entry.move;
+
+        // Never cut off at the root, we need a move to play
+        if (isRoot) hit = false;
+
+        if (hit && entry.depth >= depth)
+        {
+            double score = maximizing ? entry.score : -entry.score;
+            enum TTBound bound = (enum TTBound)entry.bound;
+
+            if (!maximizing && bound == TT_BOUND_LOWER) bound = TT_BOUND_UPPER;
+            else if (!maximizing && bound == TT_BOUND_UPPER) bound = TT_BOUND_LOWER;
+
+            if (bound == TT_BOUND_EXACT) return score;
+            if (bound == TT_BOUND_LOWER && score >= beta) return beta;
+            if (bound == TT_BOUND_UPPER && score <= alpha) return alpha;
+        }
+    }
+
+    double score;
+    enum TTBound bound;
+
     if (maximizing)
     {
         bool betaCutoff = false;
         int nmoves = 0;
 
-        generateMovesFast(board,
-                [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) 
-                { 
-                    ChessMove mm;            
-    
-                    if (kingIsInCheck(b, !b.m_isWhitesTurn)) return false; 
-                    nmoves ++;
-                    double newscore = minimaxAlphaBetaFaster(b, white, mm, false, depth - 1, npos, alpha, beta); 
-                    
-                    if (newscore >= beta)
-                    {    
-                        betaCutoff = true;
-                        return true; 
-                    }
-                    if (newscore > alpha)
-                    {
-                        alpha = newscore;
+        MovePicker picker(*this, board, ttMove, ply);
+        ScoredMove sm;
+
+        while (picker.next(sm))
+        {
+            ChessMove mm;
+            UndoRecord undo;
+
+            nmoves ++;
+
+            board.makeMove(sm.piece, sm.from, sm.to, sm.type, undo);
+            double newscore = minimaxAlphaBetaFaster(board, white, mm, false, depth - 1, npos, alpha, beta, ply + 1);
+            board.unmakeMove(sm.piece, sm.from, sm.to, sm.type, undo);
+
+            if (m_stopSearch) break;
+            
+            if (newscore >= beta)
+            {    
+                betaCutoff = true;
+                bestMove = sm.packed();
+
+                if (ChessBoard::isQuiet(sm.type))
+                    updateQuietHistory(board.m_isWhitesTurn, bestMove, depth, ply);
+                break; 
+            }
+            if (newscore > alpha)
+            {
+                alpha = newscore;
+                bestMove = sm.packed();
 
-                        if (isRoot)
-                            moveFromBitboards(move, from, to, type); 
-                    }
+                if (isRoot)
+                    moveFromBitboards(move, sm.from, sm.to, sm.type); 
+            }
+        }
 
-                    return false;
-                }, oppKingDead);
+        // Out of time: unwind without storing anything, the result is discarded
+        if (m_stopSearch) return 0.0;
 
         if (nmoves == 0)
         {
             double whiteScore = 0.0;
             double blackScore = 0.0;
-            double score = 0.0;
 
             evalBoardFaster(board, whiteScore, blackScore, true);
 
@@ -1791,13 +1935,18 @@ double Chess::minimaxAlphaBetaFaster(ChessBoard& board, bool white, ChessMove& m
                 score = blackScore - whiteScore;
             }
 
-            return score;
+            bound = TT_BOUND_EXACT;
+        }
+        else if (betaCutoff) 
+        {
+            score = beta;
+            bound = TT_BOUND_LOWER;
         }
-        if (betaCutoff) 
+        else
         {
-            return beta;
+            score = alpha;
+            bound = (alpha > alphaOrig) ? TT_BOUND_EXACT : TT_BOUND_UPPER;
         }
-        return alpha;
     }
     else
     {
@@ -1805,33 +1954,47 @@ double Chess::minimaxAlphaBetaFaster(ChessBoard& board, bool white, ChessMove& m
 
         int nmoves = 0;
 
-        generateMovesFast(board, 
-                [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type)
-                {
-                    ChessMove mm;            
-    
-                    if (kingIsInCheck(b, !b.m_isWhitesTurn)) return false; 
-                    nmoves ++;
-                    double newscore = minimaxAlphaBetaFaster(b, white, mm, true, depth - 1, npos, alpha, beta); 
-                    if (newscore <= alpha)
-                    {
-                        alphaCutoff = true;
-                        return true;
-                    }
-                    if (newscore < beta)
-                    {
-                        beta = newscore;
-                        if (isRoot) // root
-                            moveFromBitboards(move, from, to, type); 
-                    }
-                    
-                    return false; 
-                }, oppKingDead);
+        MovePicker picker(*this, board, ttMove, ply);
+        ScoredMove sm;
+
+        while (picker.next(sm))
+        {
+            ChessMove mm;
+            UndoRecord undo;
+
+            nmoves ++;
+
+            board.makeMove(sm.piece, sm.from, sm.to, sm.type, undo);
+            double newscore = minimaxAlphaBetaFaster(board, white, mm, true, depth - 1, npos, alpha, beta, ply + 1);
+            board.unmakeMove(sm.piece, sm.from, sm.to, sm.type, undo);
+
+            if (m_stopSearch) break;
+
+            if (newscore <= alpha)
+            {
+                alphaCutoff = true;
+                bestMove = sm.packed();
+
+                if (ChessBoard::isQuiet(sm.type))
+                    updateQuietHistory(board.m_isWhitesTurn, bestMove, depth, ply);
+                break;
+            }
+            if (newscore < beta)
+            {
+                beta = newscore;
+                bestMove = sm.packed();
+
+                if (isRoot) // root
+                    moveFromBitboards(move, sm.from, sm.to, sm.type); 
+            }
+        }
+
+        if (m_stopSearch) return 0.0;
+
         if (nmoves == 0)
         {
             double whiteScore = 0.0;
             double blackScore = 0.0;
-            double score = 0.0;
 
             evalBoardFaster(board, whiteScore, blackScore, true);
 
@@ -1846,449 +2009,628 @@ double Chess::minimaxAlphaBetaFaster(ChessBoard& board, bool white, ChessMove& m
                 score = blackScore - whiteScore;
             }
 
-            return score;
+            bound = TT_BOUND_EXACT;
+        }
+        else if (alphaCutoff) 
+        {
+            score = alpha;
+            bound = TT_BOUND_UPPER;
         }
-        if (alphaCutoff) 
+        else
         {
-            return alpha;
+            score = beta;
+            bound = (beta < betaOrig) ? TT_BOUND_EXACT : TT_BOUND_LOWER;
         }
-        return beta;
     }
 
-    return 0.0;
+    if (m_useTranspositionTable)
+    {
+        // Convert to the side to move's point of view
+        if (!maximizing && bound == TT_BOUND_LOWER) bound = TT_BOUND_UPPER;
+        else if (!maximizing && bound == TT_BOUND_UPPER) bound = TT_BOUND_LOWER;
+
+        m_tt->store(hash, depth, bound, maximizing ? score : -score, bestMove);
+        m_ttStores++;
+    }
+
+    return score;
 }
 
-void Chess::generateMovesFast(ChessBoard& board, std::function<bool (ChessBoard& b, uint64_t from_bb, uint64_t to_bb, enum MoveType type)> func, bool& oppKingDead)
+int Chess::see(const ChessBoard& board, uint64_t from, uint64_t to, enum MoveType type)
 {
+    // Swap list: https://www.chessprogramming.org/SEE_-_The_Swap_Algorithm
+    int gain[32];
+    int d = 0;
 
-    uint64_t myPieces  = 0;
-    uint64_t oppPieces = 0;
-    uint64_t allPieces = 0;
-    uint64_t *myPawnAttacks;
-    uint64_t *myPawnMoves;
-    uint64_t enPassentSq;
-    uint64_t enPassentOriginSq;
-    uint64_t kingMoveSquares = 0;
-    uint64_t promoteBitmask = 0;    
+    bool side = board.m_isWhitesTurn;
+    int toSq = bitScanForward(to);
 
-    if (board.m_isWhitesTurn)
+    const uint64_t* boards[2][6] = {
+        { &board.blackPawnsBoard, &board.blackKnightsBoard, &board.blackBishopsBoard,
+          &board.blackRooksBoard, &board.blackQueensBoard, &board.blackKingsBoard },
+        { &board.whitePawnsBoard, &board.whiteKnightsBoard, &board.whiteBishopsBoard,
+          &board.whiteRooksBoard, &board.whiteQueensBoard, &board.whiteKingsBoard }
+    };
+
+    uint64_t diagonal = board.whiteBishopsBoard | board.blackBishopsBoard | board.whiteQueensBoard | board.blackQueensBoard;
+    uint64_t straight = board.whiteRooksBoard | board.blackRooksBoard | board.whiteQueensBoard | board.blackQueensBoard;
+    uint64_t occupied = board.allWhitePieces() | board.allBlackPieces();
+
+    int victim = (type == EN_PASSENT) ? PIECE_PAWN : board.pieceOn(to, !side);
+    int attackerValue = kSeeValues[board.pieceOn(from, side)];
+
+    gain[0] = (victim >= 0) ? kSeeValues[victim] : 0;
+
+    if (ChessBoard::isPromotion(type))
     {
-        myPieces     = board.allWhitePieces();
-        oppPieces    = board.allBlackPieces();
-        allPieces    = board.allWhitePieces() | board.allBlackPieces();
-        myPawnMoves     = m_pawnMovesWhite;
-        myPawnAttacks   = m_pawnAttacksWhite;
-        if (board.m_can_en_passant_file != INVALID_FILE)
-        {
-            enPassentSq             = COORD_TO_BIT(board.m_can_en_passant_file, SIXTH_RANK);
-            enPassentOriginSq       = COORD_TO_BIT(board.m_can_en_passant_file, FIFTH_RANK);
-        }
-        else
-        {
-            enPassentSq         = 0;
-            enPassentOriginSq   = 0;
-        }
-        promoteBitmask = 0xff00'0000'0000'0000;    
+        attackerValue = kSeeValues[ChessBoard::promotionPiece(type)];
+        gain[0] += attackerValue - kSeeValues[PIECE_PAWN];
     }
-    else
+
+    if (type == EN_PASSENT) occupied &= ~board.enPassantVictim(to);
+
+    uint64_t attackers = attackersOf(board, toSq, true, occupied) | attackersOf(board, toSq, false, occupied);
+
+    while (true)
     {
-        myPieces     = board.allBlackPieces();
-        oppPieces    = board.allWhitePieces();
-        allPieces    = board.allWhitePieces() | board.allBlackPieces();
-        myPawnMoves     = m_pawnMovesBlack;
-        myPawnAttacks   = m_pawnAttacksBlack;
+        d++;
 
-        if (board.m_can_en_passant_file != INVALID_FILE)
-        {
-            enPassentSq             = COORD_TO_BIT(board.m_can_en_passant_file, THIRD_RANK);
-            enPassentOriginSq       = COORD_TO_BIT(board.m_can_en_passant_file, FOURTH_RANK);
-        }
-        else
+        // Score for the side now on move if it captures the piece that just arrived on the square
+        gain[d] = attackerValue - gain[d - 1];
+
+        // Take the capturing piece off the board. A slider lined up behind it can now reach the square.
+        int fromSq = bitScanForward(from);
+
+        occupied &= ~from;
+
+        if (m_arrBehind[toSq][fromSq] & (diagonal | straight) & occupied)
+            attackers |= (m_magicbb->bishopAttacks(toSq, occupied) & diagonal) |
+                         (m_magicbb->rookAttacks(toSq, occupied) & straight);
+
+        attackers &= occupied;
+        side = !side;
+
+        // The next capture is made with the least valuable attacker
+        from = 0;
+
+        for (int piece = PIECE_PAWN; piece <= PIECE_KING; piece++)
         {
-            enPassentSq         = 0;
-            enPassentOriginSq   = 0;
+            uint64_t bb = attackers & *boards[side][piece];
+
+            if (bb)
+            {
+                // The king can only take last
+                if (piece == PIECE_KING && (attackers & (side ? board.allBlackPieces() : board.allWhitePieces())))
+                    break;
+
+                from = bb & -bb;
+                attackerValue = kSeeValues[piece];
+                break;
+            }
         }
-        promoteBitmask = 0x0000'0000'0000'00ff;    
+
+        if (!from) break;
     }
 
-   // King moves
+    while (--d)
+        gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
 
-    for (uint64_t bb = *board.myKings(); bb != 0; bb &= bb - 1)
-    {
-        uint64_t king = bb & -bb;
-        int kingSq = bitScanForward(king);
-        uint64_t moves = m_pieceMoves[PIECE_KING][kingSq];
+    return gain[0];
+}
 
-        moves &= ~myPieces;
+// Late move reductions, by depth and move number. Reduce more the deeper the search and the
+// later the move, growing with the log of each.
+static const auto kLmrReductions = [] {
+    std::array<std::array<int, 64>, 64> table {};
 
-        for (; moves != 0; moves &= moves - 1)
-        {
-            uint64_t mm = moves & -moves;
+    for (int depth = 1; depth < 64; depth++)
+        for (int move = 1; move < 64; move++)
+            table[depth][move] = (int)(0.75 + std::log(depth) * std::log(move) / 2.25);
 
-            ChessBoard newb(board);
+    return table;
+}();
 
-            *newb.myKings() = (*newb.myKings() & ~king) | mm;
-            newb.clearOppPieces(mm);
-            *newb.myKingHasMoved() = true;
-            newb.nextTurn();
+double Chess::principalVariationSearch(ChessBoard& board, ChessMove& move, int depth, uint64_t& npos, double alpha, double beta,
+                                       int ply, bool allowNullMove)
+{
+    // Scout searches only need to tell whether a move beats alpha. Scores are stored in the
+    // transposition table as floats, so the window can't be much narrower than this.
+    constexpr double kNullWindow = 1e-3;
 
-            if (func(newb, king, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+    // Frontier pruning margins in pawns, by remaining depth
+    constexpr double kFutilityMargin[] = { 0.0, 1.0, 2.0, 3.0 };
+    constexpr double kRazorMargin[] = { 0.0, 3.0, 4.0 };
+    constexpr double kReverseFutilityMargin = 1.0;     // Per ply
 
-        }
+    bool isRoot = ply == 0;
 
+    // Empty until a move here beats alpha
+    if (ply < kMaxPly) m_pvLength[ply] = ply;
+
+    if (depth == 0)
+    {
+        npos ++;
+
+        if (m_useQuiescence)
+            return quiescence(board, board.m_isWhitesTurn, true, alpha, beta, ply);
+
+        if ((npos & 1023) == 0) checkSearchTime();
+
+        double whiteScore = 0.0;
+        double blackScore = 0.0;
+
+        evalBoardFaster(board, whiteScore, blackScore);
+
+        return board.m_isWhitesTurn ? whiteScore - blackScore : blackScore - whiteScore;
     }
 
-    // Castling
+    uint64_t hash = 0;
+    double alphaOrig = alpha;
+    uint16_t bestMove = 0;
+    uint16_t ttMove = 0;
 
-    if ((board.m_isWhitesTurn) && (!board.m_whiteKingHasMoved) && !kingIsInCheck(board, true))
+    if (m_useTranspositionTable)
     {
+        hash = board.hash();
 
-        // Check King side castling
-        //if ((getPieceForSquare(board, F_FILE, FIRST_RANK) == NO_PIECE) &&
-        //    (getPieceForSquare(board, G_FILE, FIRST_RANK) == NO_PIECE) &&
-        //    !board.m_whiteHRookHasMoved && (getPieceForSquare(board, H_FILE, FIRST_RANK) == WHITE_ROOK))
-        if ((allPieces & (COORD_TO_BIT(F_FILE,FIRST_RANK) | COORD_TO_BIT(G_FILE, FIRST_RANK)) == 0) && !board.m_whiteHRookHasMoved)
-        {
-            if (!movePutsPlayerInCheck(board, E_FILE, FIRST_RANK, F_FILE, FIRST_RANK, true) && !movePutsPlayerInCheck(board, E_FILE, FIRST_RANK, G_FILE, FIRST_RANK, true))
-            {
-                kingMoveSquares |= COORD_TO_BIT(G_FILE, FIRST_RANK); 
-            }  
-        }
+        TTEntry entry;
 
-        // Check Queen side castling
-        //if ((getPieceForSquare(board, D_FILE, FIRST_RANK) == NO_PIECE) &&
-        //    (getPieceForSquare(board, C_FILE, FIRST_RANK) == NO_PIECE) &&
-        //    (getPieceForSquare(board, B_FILE, FIRST_RANK) == NO_PIECE) &&
-        //    !board.m_whiteARookHasMoved && (getPieceForSquare(board, A_FILE, FIRST_RANK) == WHITE_ROOK))
-        
-        if ((allPieces & (COORD_TO_BIT(D_FILE,FIRST_RANK) | COORD_TO_BIT(C_FILE, FIRST_RANK) | COORD_TO_BIT(B_FILE, FIRST_RANK)) == 0) && !board.m_whiteARookHasMoved)
+        m_ttProbes++;
+
+        if (m_tt->probe(hash, entry))
         {
-            if (!movePutsPlayerInCheck(board, E_FILE, FIRST_RANK, D_FILE, FIRST_RANK, true) && !movePutsPlayerInCheck(board, E_FILE, FIRST_RANK, C_FILE, FIRST_RANK, true))
+            m_ttHits++;
+            ttMove = entry.move;
+
+            if (!isRoot && entry.depth >= depth)
             {
-                kingMoveSquares |= COORD_TO_BIT(C_FILE, FIRST_RANK);
+                if (entry.bound == TT_BOUND_EXACT) return entry.score;
+                if (entry.bound == TT_BOUND_LOWER && entry.score >= beta) return entry.score;
+                if (entry.bound == TT_BOUND_UPPER && entry.score <= alpha) return entry.score;
             }
         }
-
     }
-    else if ((!board.m_isWhitesTurn) && (!board.m_blackKingHasMoved) && !kingIsInCheck(board, false))
+
+    bool pvNode = beta - alpha > 2 * kNullWindow;
+    bool inCheck = sideToMoveInCheck(board);
+
+    // The pruning below all works from the static evaluation, which means nothing in check
+    // and isn't trusted on the principal variation
+    bool canPrune = !pvNode && !isRoot && !inCheck;
+    double staticEval = 0.0;
+
+    if (canPrune)
     {
+        double whiteScore = 0.0;
+        double blackScore = 0.0;
 
-        // Check King side castling
-        //if ((getPieceForSquare(board, F_FILE, EIGHTH_RANK) == NO_PIECE) &&
-        //    (getPieceForSquare(board, G_FILE, EIGHTH_RANK) == NO_PIECE) &&
-        //    !board.m_blackHRookHasMoved && (getPieceForSquare(board, H_FILE, EIGHTH_RANK) == BLACK_ROOK))
-        
-        if ((allPieces & (COORD_TO_BIT(F_FILE,EIGHTH_RANK) | COORD_TO_BIT(G_FILE, EIGHTH_RANK)) == 0) && !board.m_blackHRookHasMoved)
-        {
-            if (!movePutsPlayerInCheck(board, E_FILE, EIGHTH_RANK, F_FILE, EIGHTH_RANK, false) && !movePutsPlayerInCheck(board, E_FILE, EIGHTH_RANK, G_FILE, EIGHTH_RANK, false))
-            {
-                kingMoveSquares |= COORD_TO_BIT(G_FILE, EIGHTH_RANK); 
-            }
-        }
+        evalBoardFaster(board, whiteScore, blackScore);
 
-        // Check Queen side castling
-        //if ((getPieceForSquare(board, D_FILE, EIGHTH_RANK) == NO_PIECE) &&
-        //    (getPieceForSquare(board, C_FILE, EIGHTH_RANK) == NO_PIECE) &&
-        //    (getPieceForSquare(board, B_FILE, EIGHTH_RANK) == NO_PIECE) &&
-        //    !board.m_blackARookHasMoved && (getPieceForSquare(board, A_FILE, EIGHTH_RANK) == BLACK_ROOK))
-        
-        if ((allPieces & (COORD_TO_BIT(D_FILE,FIRST_RANK) | COORD_TO_BIT(C_FILE, EIGHTH_RANK) | COORD_TO_BIT(B_FILE, EIGHTH_RANK)) == 0) && !board.m_blackARookHasMoved)
-        {
-            if (!movePutsPlayerInCheck(board, E_FILE, EIGHTH_RANK, D_FILE, EIGHTH_RANK, false) && !movePutsPlayerInCheck(board, E_FILE, EIGHTH_RANK, C_FILE, EIGHTH_RANK, false))
-            {
-                kingMoveSquares |= COORD_TO_BIT(C_FILE, EIGHTH_RANK); 
-            }
-        }
+        staticEval = board.m_isWhitesTurn ? whiteScore - blackScore : blackScore - whiteScore;
+    }
 
+    // Reverse futility pruning (static null move): https://www.chessprogramming.org/Reverse_Futility_Pruning
+    // So far above beta that the opponent can't be expected to recover in the few plies left
+    if (m_useFutility && canPrune && depth <= 3 && staticEval - kReverseFutilityMargin * depth >= beta)
+    {
+        m_reverseFutilityPrunes++;
+        return staticEval;
     }
 
-    if (kingMoveSquares)
+    // Razoring: https://www.chessprogramming.org/Razoring
+    // So far below alpha that only a capture could help, so ask the quiescence search
+    if (m_useFutility && canPrune && depth <= 2 && staticEval + kRazorMargin[depth] < alpha)
     {
-        for (uint64_t bb = *board.myKings(); bb != 0; bb &= bb - 1)
+        double score = quiescence(board, board.m_isWhitesTurn, true, alpha, alpha + kNullWindow, ply);
+
+        if (m_stopSearch) return 0.0;
+
+        if (score <= alpha)
         {
-            uint64_t king = bb & -bb;
+            m_razorPrunes++;
+            return score;
+        }
+    }
 
-            for (; kingMoveSquares != 0; kingMoveSquares &= kingMoveSquares - 1)
-            {
-                uint64_t mm = kingMoveSquares & -kingMoveSquares;
+    // Null move pruning: https://www.chessprogramming.org/Null_Move_Pruning
+    // If we could pass and a reduced search still fails high, a real move will almost certainly
+    // do at least as well. Only tried in null window nodes, never twice in a row, and not when
+    // in check (passing would be illegal) or with only king and pawns left, where zugzwang is
+    // common and passing is often the best "move" there is.
+    if (m_useNullMove && allowNullMove && canPrune && depth >= 3 && staticEval >= beta)
+    {
+        uint64_t pieces = board.m_isWhitesTurn ?
+            board.whiteKnightsBoard | board.whiteBishopsBoard | board.whiteRooksBoard | board.whiteQueensBoard :
+            board.blackKnightsBoard | board.blackBishopsBoard | board.blackRooksBoard | board.blackQueensBoard;
 
-                ChessBoard newb(board);
-                enum MoveType type = BASIC_MOVE;
+        if (pieces)
+        {
+            // Adaptive R: reduce more when there is depth to spare
+            int R = (depth > 6) ? 3 : 2;
 
-                *newb.myKings() = (*newb.myKings() & ~king) | mm;
-                if      (mm == COORD_TO_BIT(G_FILE, FIRST_RANK))
-                {
-                    *newb.myRooks() = (*newb.myRooks() & ~COORD_TO_BIT(H_FILE, FIRST_RANK)) | COORD_TO_BIT(F_FILE, FIRST_RANK);
-                    type = CASTLE_KING_SIDE;
-                }
-                else if (mm == COORD_TO_BIT(C_FILE, FIRST_RANK))
-                {
-                    *newb.myRooks() = (*newb.myRooks() & ~COORD_TO_BIT(A_FILE, FIRST_RANK)) | COORD_TO_BIT(D_FILE, FIRST_RANK);
-                    type = CASTLE_QUEEN_SIDE;
-                }
-                else if (mm == COORD_TO_BIT(G_FILE, EIGHTH_RANK))
-                {
-                    *newb.myRooks() = (*newb.myRooks() & ~COORD_TO_BIT(H_FILE, EIGHTH_RANK)) | COORD_TO_BIT(F_FILE, EIGHTH_RANK);
-                    type = CASTLE_KING_SIDE;
-                }
-                else if (mm == COORD_TO_BIT(C_FILE, EIGHTH_RANK))
-                {
-                    *newb.myRooks() = (*newb.myRooks() & ~COORD_TO_BIT(A_FILE, EIGHTH_RANK)) | COORD_TO_BIT(D_FILE, EIGHTH_RANK);
-                    type = CASTLE_QUEEN_SIDE;
-                }  
+            ChessMove mm;
+            UndoRecord undo;
 
-                *newb.myKingHasMoved() = true;
+            m_nullMoveTries++;
 
-                newb.nextTurn();
+            board.makeNullMove(undo);
+            double score = -principalVariationSearch(board, mm, std::max(depth - 1 - R, 0), npos, -beta, -beta + kNullWindow, ply + 1, false);
+            board.unmakeNullMove(undo);
 
-                if (func(newb, king, mm, type)) goto done;
+            if (m_stopSearch) return 0.0;
 
+            // Don't trust a mate score from a position where we passed
+            if (score >= beta)
+            {
+                m_nullMoveCutoffs++;
+                return beta;
             }
         }
     }
 
-    // Pawn moves
-    for (uint64_t bb = *board.myPawns(); bb != 0; bb &= bb - 1)
+    // Futility pruning: https://www.chessprogramming.org/Futility_Pruning
+    // Near the horizon, a quiet move won't lift a position this far below alpha, so don't
+    // search those. Captures are kept unless the exchange still leaves us short.
+    bool futile = m_useFutility && canPrune && depth <= 3 && staticEval + kFutilityMargin[std::min(depth, 3)] <= alpha;
+    double futilityValue = staticEval + kFutilityMargin[std::min(depth, 3)];
+
+    // While still on the last iteration's principal variation, search its move first. The
+    // transposition table usually has it too, but entries along the line can be overwritten.
+    // A line left over from another position must not reach makeMove, so check the move first.
+    uint16_t pvMove = 0;
+
+    if (m_followPV)
     {
-        uint64_t pawn = bb & -bb;
-        int pawnSq = bitScanForward(pawn);
+        if (ply < (int)m_principalVariation.size() && moveIsLegal(board, m_principalVariation[ply]))
+            pvMove = m_principalVariation[ply];
+        else
+            m_followPV = false;
+    }
 
-        uint64_t m = myPawnMoves[pawnSq];
-        for (uint64_t mb = m & allPieces; mb != 0; mb &= (mb - 1))
-        {
-            int sq = bitScanForward(mb);
-            m &= ~m_arrBehind[pawnSq][sq];
-        }
-      
-        m &= ~allPieces;
+    MovePicker picker(*this, board, pvMove ? pvMove : ttMove, ply);
+    ScoredMove sm;
+    int nmoves = 0;
+    int searchedMoves = 0;      // Not counting moves skipped by futility pruning
+    double bestScore = -kInfinity;
 
-        for (; m != 0; m &= (m-1))
-        {
-            uint64_t mm = m & -m;
-            if (mm & promoteBitmask)
-            {
-                // Generate promote to queen
-                {
-                    ChessBoard newb(board);
+    while (picker.next(sm))
+    {
+        ChessMove mm;
+        UndoRecord undo;
+        double score;
 
-                    *newb.myPawns() = (*newb.myPawns() & ~pawn) | mm;
-                    *newb.myQueens() = *newb.myQueens() | mm;
-                    newb.nextTurn();
+        nmoves ++;
 
-                    if (func(newb, pawn, mm, PROMOTE_TO_QUEEN)) goto done;
+        // Exchange value from the mover's point of view, taken before the move is made
+        int exchange = (futile && !ChessBoard::isQuiet(sm.type)) ? see(board, sm.from, sm.to, sm.type) : 0;
 
-                }
+        board.makeMove(sm.piece, sm.from, sm.to, sm.type, undo);
 
-                // Generate promote to rook
+        bool givesCheck = sideToMoveInCheck(board);
 
-                {
-                    ChessBoard newb(board);
+        if (futile && !givesCheck && nmoves > 1 && futilityValue + exchange / 100.0 <= alpha)
+        {
+            board.unmakeMove(sm.piece, sm.from, sm.to, sm.type, undo);
 
-                    *newb.myPawns() = (*newb.myPawns() & ~pawn) | mm;
-                    *newb.myRooks() = *newb.myRooks() | mm;
-                    newb.nextTurn();
+            m_futilityPrunes++;
+            bestScore = std::max(bestScore, futilityValue + exchange / 100.0);
+            continue;
+        }
 
-                    if (func(newb, pawn, mm, PROMOTE_TO_ROOK)) goto done;
+        // Late move reductions: https://www.chessprogramming.org/Late_Move_Reductions
+        // With good ordering, a quiet move this far down the list is very unlikely to be best,
+        // so search it less deeply. Captures, promotions, killers, check evasions and checking
+        // moves are searched in full.
+        int reduction = 0;
 
-                }
+        searchedMoves ++;
 
-                // Generate promote to bishop
+        if (m_useLMR && depth >= 3 && searchedMoves >= 4 && !inCheck && !givesCheck && ChessBoard::isQuiet(sm.type) &&
+            (ply >= kMaxPly || (sm.packed() != m_killers[ply][0] && sm.packed() != m_killers[ply][1])))
+        {
+            reduction = kLmrReductions[std::min(depth, 63)][std::min(searchedMoves, 63)];
 
-                {
-                    ChessBoard newb(board);
+            if (pvNode) reduction--;
 
-                    *newb.myPawns() = (*newb.myPawns() & ~pawn) | mm;
-                    *newb.myBishops() = *newb.myBishops() | mm;
-                    newb.nextTurn();
+            reduction = std::clamp(reduction, 0, depth - 2);
 
-                    if (func(newb, pawn, mm, PROMOTE_TO_BISHOP)) goto done;
+            if (reduction) m_lmrReductions++;
+        }
 
-                }
+        // The first move is searched with the full window. The rest are expected to be worse,
+        // so prove it with a null window, and only search again in full if one turns out better.
+        if (nmoves == 1)
+        {
+            if (m_followPV && sm.packed() != pvMove) m_followPV = false;
 
-                // Generate promote to knight
+            score = -principalVariationSearch(board, mm, depth - 1, npos, -beta, -alpha, ply + 1);
 
-                {
-                    ChessBoard newb(board);
+            // Only the first move can be on the old line
+            m_followPV = false;
+        }
+        else
+        {
+            score = -principalVariationSearch(board, mm, depth - 1 - reduction, npos, -alpha - kNullWindow, -alpha, ply + 1);
 
-                    *newb.myPawns() = (*newb.myPawns() & ~pawn) | mm;
-                    *newb.myKnights() = *newb.myKnights() | mm;
-                    newb.nextTurn();
+            // A reduced move that beats alpha gets another look at full depth
+            if (reduction && score > alpha && !m_stopSearch)
+            {
+                m_lmrReSearches++;
+                score = -principalVariationSearch(board, mm, depth - 1, npos, -alpha - kNullWindow, -alpha, ply + 1);
+            }
 
-                    if (func(newb, pawn, mm, PROMOTE_TO_KNIGHT)) goto done;
+            if (score > alpha && score < beta && !m_stopSearch)
+                score = -principalVariationSearch(board, mm, depth - 1, npos, -beta, -alpha, ply + 1);
+        }
 
-                }
+        board.unmakeMove(sm.piece, sm.from, sm.to, sm.type, undo);
 
-            }
-            else
-            {
-                ChessBoard newb(board);
+        if (m_stopSearch) break;
 
-                int newPawnSq = bitScanForward(mm);
+        if (score > bestScore)
+            bestScore = score;
 
-                if (abs(newPawnSq - pawnSq) == 16) newb.m_can_en_passant_file = pawnSq & 7;
+        if (score > alpha)
+        {
+            alpha = score;
+            bestMove = sm.packed();
 
-                *newb.myPawns() = (*newb.myPawns() & ~pawn) | mm;
-                newb.nextTurn();
+            updatePV(ply, bestMove);
 
-                if (func(newb, pawn, mm, BASIC_MOVE)) goto done;
-            }
+            if (isRoot)
+                moveFromBitboards(move, sm.from, sm.to, sm.type);
+        }
+        if (score >= beta)
+        {
+            if (ChessBoard::isQuiet(sm.type))
+                updateQuietHistory(board.m_isWhitesTurn, bestMove, depth, ply);
+            break;
         }
+    }
 
-        // Pawn captures
-        m = myPawnAttacks[pawnSq];
+    // Out of time: unwind without storing anything, the result is discarded
+    if (m_stopSearch) return 0.0;
 
-        m &= oppPieces;
+    enum TTBound bound;
 
-        for (; m != 0; m &= (m-1))
-        {
-            uint64_t mm = m & -m;
+    if (nmoves == 0)
+    {
+        double whiteScore = 0.0;
+        double blackScore = 0.0;
 
-            ChessBoard newb(board);
+        evalBoardFaster(board, whiteScore, blackScore, true);
 
-            *newb.myPawns() = (*newb.myPawns() & ~pawn) | mm;
-            newb.clearOppPieces(mm);
+        npos++;
 
-            newb.nextTurn();
+        bestScore = board.m_isWhitesTurn ? whiteScore - blackScore : blackScore - whiteScore;
+        bound = TT_BOUND_EXACT;
+    }
+    else if (bestScore >= beta)
+        bound = TT_BOUND_LOWER;
+    else
+        bound = (bestScore > alphaOrig) ? TT_BOUND_EXACT : TT_BOUND_UPPER;
 
-            if (func(newb, pawn, mm, CAPTURE)) goto done;
-        }
+    if (m_useTranspositionTable)
+    {
+        m_ttStores++;
+        m_tt->store(hash, depth, bound, bestScore, bestMove);
+    }
 
-        // En passents 
+    return bestScore;
+}
 
-        m = myPawnAttacks[pawnSq];
+// Quiescence search: https://www.chessprogramming.org/Quiescence_Search
+// At the horizon keep playing captures and promotions until the position is quiet, so that a
+// piece left hanging on the last ply isn't scored as if it were safe. The side to move may
+// "stand pat" on the static evaluation rather than capture, except in check, where every
+// evasion is tried. Scores are from white's point of view as in minimaxAlphaBetaFaster().
+double Chess::quiescence(ChessBoard& board, bool white, bool maximizing, double alpha, double beta, int ply)
+{
+    // Material values used by evalBoardFaster, indexed by SimplePieceTypes
+    static constexpr double kPieceValues[] = { 1.0, 3.0, 3.0, 5.0, 9.0, 900.0 };
 
-        m &= enPassentSq;
+    // Positional terms can't make up more than this, so a capture that still leaves us below
+    // alpha by more than the margin isn't worth searching: https://www.chessprogramming.org/Delta_Pruning
+    constexpr double kDeltaMargin = 2.0;
 
-        if (m)
-        {
-            ChessBoard newb(board);
+    m_qsearchNodes++;
 
-            *newb.myPawns() = (*newb.myPawns() & ~pawn) | m;
-            newb.clearOppPieces(enPassentOriginSq);
+    if ((m_qsearchNodes & 1023) == 0) checkSearchTime();
 
-            newb.nextTurn();
+    if (m_stopSearch) return 0.0;
 
-            if (func(newb, pawn, m, EN_PASSENT)) goto done;
-        }
-    }    
+    bool sideToMove = board.m_isWhitesTurn;
+    bool inCheck = sideToMoveInCheck(board);
 
+    double whiteScore = 0.0;
+    double blackScore = 0.0;
 
-    // Knight moves
+    evalBoardFaster(board, whiteScore, blackScore);
 
-    for (uint64_t bb = *board.myKnights(); bb != 0; bb &= bb - 1)
+    double standPat = white ? whiteScore - blackScore : blackScore - whiteScore;
+
+    if (!inCheck)
     {
-        uint64_t knight = bb & -bb;
-        int knightSq = bitScanForward(knight);
-        uint64_t moves = m_pieceMoves[PIECE_KNIGHT][knightSq];
+        if (maximizing)
+        {
+            if (standPat >= beta) return beta;
+            if (standPat > alpha) alpha = standPat;
+        }
+        else
+        {
+            if (standPat <= alpha) return alpha;
+            if (standPat < beta) beta = standPat;
+        }
+    }
 
-        moves &= ~myPieces;
+    if (ply >= kMaxPly) return standPat;
 
-        for (; moves != 0; moves &= moves - 1)
-        {
-            uint64_t mm = moves & -moves;
+    MovePicker picker = inCheck ? MovePicker(*this, board, 0, ply) : MovePicker(*this, board);
+    ScoredMove sm;
+    int nmoves = 0;
 
-            ChessBoard newb(board);
+    while (picker.next(sm))
+    {
+        nmoves++;
 
-            *newb.myKnights() = (*newb.myKnights() & ~knight) | mm;
-            newb.clearOppPieces(mm);
-             
-            newb.nextTurn();
+        if (!inCheck)
+        {
+            // Underpromotions are never better than the queen promotion here
+            if (ChessBoard::isPromotion(sm.type) && sm.type != PROMOTE_TO_QUEEN) continue;
 
-            if (func(newb, knight, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+            if (!ChessBoard::isPromotion(sm.type))
+            {
+                int victim = (sm.type == EN_PASSENT) ? PIECE_PAWN : board.pieceOn(sm.to, !sideToMove);
+                double gain = kPieceValues[victim] + kDeltaMargin;
 
+                if (maximizing ? standPat + gain <= alpha : standPat - gain >= beta) continue;
+            }
         }
 
+        UndoRecord undo;
+
+        board.makeMove(sm.piece, sm.from, sm.to, sm.type, undo);
+        double score = quiescence(board, white, !maximizing, alpha, beta, ply + 1);
+        board.unmakeMove(sm.piece, sm.from, sm.to, sm.type, undo);
+
+        if (m_stopSearch) return 0.0;
+
+        if (maximizing)
+        {
+            if (score >= beta) return beta;
+            if (score > alpha) alpha = score;
+        }
+        else
+        {
+            if (score <= alpha) return alpha;
+            if (score < beta) beta = score;
+        }
     }
-    
-    // Bishop moves
 
-    for (uint64_t bb = *board.myBishops(); bb != 0; bb &= bb - 1)
+    // Checkmate
+    if (inCheck && nmoves == 0)
     {
-        uint64_t bishop = bb & -bb;
-        int bishopSq = bitScanForward(bishop);
-        uint64_t moves = m_magicbb->pieceAttacks(PIECE_BISHOP, bishopSq, allPieces);
+        evalBoardFaster(board, whiteScore, blackScore, true);
 
-        moves &= ~myPieces;
+        return white ? whiteScore - blackScore : blackScore - whiteScore;
+    }
 
-        for (; moves != 0; moves &= moves - 1)
-        {
-            uint64_t mm = moves & -moves;
+    return maximizing ? alpha : beta;
+}
 
-            ChessBoard newb(board);
+void Chess::updateQuietHistory(bool white, uint16_t move, int depth, int ply)
+{
+    if (ply < kMaxPly && m_killers[ply][0] != move)
+    {
+        m_killers[ply][1] = m_killers[ply][0];
+        m_killers[ply][0] = move;
+    }
 
-            *newb.myBishops() = (*newb.myBishops() & ~bishop) | mm;
-            newb.clearOppPieces(mm);
-             
-            newb.nextTurn();
+    // Cutoffs near the root prune bigger subtrees, so they count for more
+    int& history = m_history[white][move & 63][(move >> 6) & 63];
 
-            if (func(newb, bishop, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+    history += depth * depth;
 
-        }
+    if (history > kHistoryMax) ageQuietHistory();
+}
 
-    }
+void Chess::ageQuietHistory()
+{
+    for (auto& side : m_history)
+        for (auto& from : side)
+            for (int& history : from)
+                history /= 2;
+}
 
-    // Rook moves
+void Chess::clearKillers()
+{
+    std::memset(m_killers, 0, sizeof(m_killers));
+}
 
-    for (uint64_t bb = *board.myRooks(); bb != 0; bb &= bb - 1)
-    {
-        uint64_t rook = bb & -bb;
-        int rookSq = bitScanForward(rook);
-        uint64_t moves = m_magicbb->pieceAttacks(PIECE_ROOK, rookSq, allPieces);
+// move is the new best move at ply, so the line from here is it followed by the child's line
+void Chess::updatePV(int ply, std::uint16_t move)
+{
+    if (ply >= kMaxPly) return;
 
-        moves &= ~myPieces;
+    m_pvTable[ply][ply] = move;
 
-        for (; moves != 0; moves &= moves - 1)
-        {
-            uint64_t mm = moves & -moves;
+    int childLength = (ply + 1 < kMaxPly) ? m_pvLength[ply + 1] : ply + 1;
 
-            ChessBoard newb(board);
+    for (int i = ply + 1; i < childLength; i++)
+        m_pvTable[ply][i] = m_pvTable[ply + 1][i];
 
-            *newb.myRooks() = (*newb.myRooks() & ~rook) | mm;
-            newb.clearOppPieces(mm);
-            if ((rookSq & 7) == A_FILE) *newb.myARookHasMoved() = true;
-            else if ((rookSq & 7) == H_FILE) *newb.myHRookHasMoved() = true;
-             
-            newb.nextTurn();
+    m_pvLength[ply] = std::max(childLength, ply + 1);
+}
 
+// Follow exact transposition table entries on from the end of m_principalVariation, as far as
+// the search depth. Each move is checked against the legal moves, and the line stops at a repetition.
+void Chess::extendPVFromTT(int depth)
+{
+    if (!m_useTranspositionTable) return;
 
-            if (func(newb, rook, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+    ChessBoard board = m_board;
+    std::vector<uint64_t> seen = { board.hash() };
 
-        }
+    auto play = [&] (std::uint16_t move) {
+        uint64_t from = 1ULL << (move & 63);
+        uint64_t to   = 1ULL << ((move >> 6) & 63);
+        UndoRecord undo;
 
-    }
+        board.makeMove((enum SimplePieceTypes)board.pieceOn(from, board.m_isWhitesTurn), from, to, (enum MoveType)(move >> 12), undo);
+        seen.push_back(board.hash());
+    };
 
-    // Queen moves
+    for (std::uint16_t move : m_principalVariation)
+        play(move);
 
-    for (uint64_t bb = *board.myQueens(); bb != 0; bb &= bb - 1)
+    while ((int)m_principalVariation.size() < std::min(depth, kMaxPly))
     {
-        uint64_t queen = bb & -bb;
-        int queenSq = bitScanForward(queen);
-        uint64_t moves = m_magicbb->pieceAttacks(PIECE_QUEEN, queenSq, allPieces);
+        TTEntry entry;
 
-        moves &= ~myPieces;
+        if (!m_tt->probe(board.hash(), entry) || entry.bound != TT_BOUND_EXACT || !entry.move) break;
 
-        for (; moves != 0; moves &= moves - 1)
-        {
-            uint64_t mm = moves & -moves;
+        if (!moveIsLegal(board, entry.move)) break;
 
-            ChessBoard newb(board);
+        m_principalVariation.push_back(entry.move);
+        play(entry.move);
 
-            *newb.myQueens() = (*newb.myQueens() & ~queen) | mm;
-            newb.clearOppPieces(mm);
-             
-            newb.nextTurn();
+        if (std::find(seen.begin(), seen.end() - 1, board.hash()) != seen.end() - 1) break;
+    }
+}
 
-            if (func(newb, queen, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+// Whether a packed move is one of the legal moves in this position
+bool Chess::moveIsLegal(ChessBoard& board, std::uint16_t move)
+{
+    bool legal = false;
+    bool oppKingDead = false;
 
-        }
+    generateMovesFast<false>(board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
+        (void)b;
 
-    }
+        legal = packMove(from, to, type) == move;
 
-done:
+        return legal;
+    }, oppKingDead);
 
-    oppKingDead = (board.oppKings() == 0);
+    return legal;
+}
 
-    return;
+std::string Chess::pvToString() const
+{
+    std::string str;
+
+    for (std::uint16_t move : m_principalVariation)
+    {
+        if (!str.empty()) str += ' ';
+        str += moveToString(1ULL << (move & 63), 1ULL << ((move >> 6) & 63), (enum MoveType)(move >> 12));
+    }
+
+    return str;
+}
+
+void Chess::generateMovesFast(ChessBoard& board, std::function<bool (ChessBoard& b, uint64_t from_bb, uint64_t to_bb, enum MoveType type)> func, bool& oppKingDead)
+{
+    generateMovesFast<true, GEN_ALL, std::function<bool (ChessBoard&, uint64_t, uint64_t, enum MoveType)>&>(board, func, oppKingDead);
 }
 
 void Chess::evalBoardFaster(const ChessBoard& board, double& white_score, double& black_score, bool noMoves)
@@ -2436,13 +2778,13 @@ void Chess::evalBoardFaster(const ChessBoard& board, double& white_score, double
 
 }
 
-std::uint64_t Chess::perft(int depth)
+std::uint64_t Chess::perft(int depth, bool bulk)
 {
-    uint64_t nodes = _perft(m_board, depth);
+    uint64_t nodes = _perft(m_board, depth, bulk);
     return nodes;
 }
 
-std::uint64_t Chess::_perft(ChessBoard& board, int depth)
+std::uint64_t Chess::_perft(ChessBoard& board, int depth, bool bulk)
 {
     if (depth == 0) return 1ULL;
     
@@ -2450,20 +2792,78 @@ std::uint64_t Chess::_perft(ChessBoard& board, int depth)
 
     bool oppKingDead = false;
 
+    // Bulk counting: the moves at the last ply are all legal, so count them without making them
+    if (bulk && depth == 1)
+    {
+        generateMovesFast<false>(board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
+            (void)b;
+            (void)from;
+            (void)to;    
+            (void)type;
+
+            nodes++;
+
+            return false;
+        }, oppKingDead);
+
+        return nodes;
+    }
+
+    // Depth 1 subtrees are cheaper to count than to look up
+    bool useCache = m_perftCache && depth >= 2;
+    uint64_t hash = board.hash();
+
+    if (useCache && m_perftCache->probe(hash, depth, nodes))
+        return nodes;
 
     generateMovesFast(board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
         (void)from;
         (void)to;    
         (void)type;
 
-        if (kingIsInCheck(b, !b.m_isWhitesTurn)) return false; 
-        nodes += _perft(b, depth - 1);
+        nodes += _perft(b, depth - 1, bulk);
         
         return false;
     }, oppKingDead);
 
     //if (oppKingDead) return 0ULL;
 
+    if (useCache)
+        m_perftCache->store(hash, depth, nodes);
+
+    return nodes;
+}
+
+void Chess::setPerftHashSize(std::size_t megabytes)
+{
+    if (megabytes == 0)
+        m_perftCache.reset();
+    else
+        m_perftCache = std::make_shared<PerftCache>(megabytes);
+}
+
+std::uint64_t Chess::perftDivide(int depth, std::vector<std::pair<std::string, std::uint64_t>>& divide, bool bulk)
+{
+    uint64_t nodes = 0;
+    bool oppKingDead = false;
+
+    divide.clear();
+
+    if (depth < 1) return _perft(m_board, depth, bulk);
+
+    generateMovesFast(m_board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
+        uint64_t n = _perft(b, depth - 1, bulk);
+
+        divide.emplace_back(moveToString(from, to, type), n);
+        printf("%s: %lu\n", divide.back().first.c_str(), n);
+
+        nodes += n;
+
+        return false;
+    }, oppKingDead);
+
+    printf("\nNodes searched: %lu\n", nodes);
+
     return nodes;
 }
 
@@ -2498,6 +2898,108 @@ std::uint64_t Chess::_perftSlow(ChessBoard& board, int depth)
 const char files[] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
 const char ranks[] = {'1', '2', '3', '4', '5', '6', '7', '8'};
 
+std::uint64_t Chess::perftParallel(int depth, int threads, bool bulk)
+{
+    threads = std::max(threads, 1);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Expand the tree a ply at a time until there is plenty of work per thread, so
+    // that a few big subtrees don't leave the other threads idle at the end.
+    std::vector<ChessBoard> work = { m_board };
+    int workDepth = depth;
+
+    while (workDepth > 2 && work.size() < (size_t)threads * 16)
+    {
+        std::vector<ChessBoard> next;
+
+        for (auto& b : work)
+        {
+            bool oppKingDead = false;
+
+            generateMovesFast(b, [&] (ChessBoard& child, uint64_t from, uint64_t to, enum MoveType type) {
+                (void)from;
+                (void)to;
+                (void)type;
+
+                next.emplace_back(child);
+
+                return false;
+            }, oppKingDead);
+        }
+
+        work.swap(next);
+        workDepth--;
+    }
+
+    std::atomic<size_t> nextItem(0);
+    std::vector<uint64_t> threadNodes(threads, 0);
+    std::vector<double> threadSecs(threads, 0.0);
+
+    auto worker = [&] (int id) {
+        uint64_t nodes = 0;
+
+        for (size_t i = nextItem++; i < work.size(); i = nextItem++)
+            nodes += _perft(work[i], workDepth, bulk);
+
+        threadNodes[id] = nodes;
+        threadSecs[id]  = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    };
+
+    std::vector<std::thread> pool;
+
+    for (int i = 1; i < threads; i++)
+        pool.emplace_back(worker, i);
+
+    worker(0);
+
+    for (auto& t : pool)
+        t.join();
+
+    double secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    uint64_t nodes = 0;
+
+    for (int i = 0; i < threads; i++)
+    {
+        nodes += threadNodes[i];
+        printf("Thread %d: %lu nodes, kNPS=%1.2f\n", i, threadNodes[i], threadNodes[i] / threadSecs[i] / 1'000.0);
+    }
+
+    printf("Perft %d: %lu nodes in %zu subtrees, kNPS=%1.2f (%1.2f sec, %d threads)\n", depth, nodes, work.size(),
+            nodes / secs / 1'000.0, secs, threads);
+
+    return nodes;
+}
+
+// Coordinate notation, e.g. e2e4 or e7e8q, as used by perft divide and UCI
+std::string Chess::moveToString(uint64_t from, uint64_t to, enum MoveType type)
+{
+    int fromSq = bitScanForward(from);
+    int toSq   = bitScanForward(to);
+
+    std::string str = { files[fromSq & 7], ranks[fromSq >> 3], files[toSq & 7], ranks[toSq >> 3] };
+
+    switch (type)
+    {
+        case PROMOTE_TO_QUEEN:
+            str += 'q';
+            break;
+        case PROMOTE_TO_ROOK:
+            str += 'r';
+            break;
+        case PROMOTE_TO_BISHOP:
+            str += 'b';
+            break;
+        case PROMOTE_TO_KNIGHT:
+            str += 'n';
+            break;
+        default:
+            break;
+    }
+
+    return str;
+}
+
 void Chess::printPrettyMove(const ChessBoard& board, const ChessMove& move)
 {
 
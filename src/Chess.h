@@ -37,10 +37,19 @@ SOFTWARE.
 #include <string>
 #include <vector>
 #include <functional>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 #include <Pieces.h>
 
 #include <Blockers.h>
+#include <Zobrist.h>
+#include <TranspositionTable.h>
+#include <PerftCache.h>
+#include <MagicBitboards.h>
+#include <AttackTables.h>
 
 enum PieceTypes {
     WHITE_PAWN      = 1 << 0,
@@ -72,6 +81,14 @@ enum MoveType {
     PROMOTE_TO_KNIGHT = 8
 };
 
+// Which moves generateMovesFast() produces. Captures include en passant and all promotions,
+// so that captures and quiets together are every legal move.
+enum MoveGenType {
+    GEN_ALL,
+    GEN_CAPTURES,
+    GEN_QUIETS
+};
+
 enum PromotionType {
     NO_PROMOTION,
     PROMOTION_PROMOTE_TO_QUEEN,
@@ -108,6 +125,16 @@ struct ChessMove {
     enum PromotionType promote;
 };
 
+// Everything needed to take back a move made with ChessBoard::makeMove()
+struct UndoRecord {
+    uint64_t hash;
+    int8_t   capturedPiece;     // SimplePieceTypes, or NO_CAPTURE
+    int8_t   enPassantFile;
+    uint8_t  castleFlags;
+
+    static constexpr int8_t NO_CAPTURE = -1;
+};
+
 struct ChessBoard {
 
     // Store the board as a series of "bit boards"
@@ -135,6 +162,10 @@ struct ChessBoard {
     bool m_blackARookHasMoved;
     bool m_blackHRookHasMoved;
 
+    // Zobrist hash of the pieces, side to move and castling flags, updated incrementally as
+    // moves are made. The en passant file is folded in by hash().
+    uint64_t m_hash;
+
     uint64_t* pawns[2];
     uint64_t* knights[2];
     uint64_t* bishops[2];
@@ -158,7 +189,7 @@ struct ChessBoard {
         blackKingsBoard   = other.blackKingsBoard;
         setUpArrays();
         m_isWhitesTurn  = other.m_isWhitesTurn;
-        m_can_en_passant_file = INVALID_FILE; //other.m_can_en_passant_file;
+        m_can_en_passant_file = other.m_can_en_passant_file;
    
         m_whiteKingHasMoved = other.m_whiteKingHasMoved;
         m_blackKingHasMoved = other.m_blackKingHasMoved;
@@ -166,9 +197,12 @@ struct ChessBoard {
         m_whiteHRookHasMoved = other.m_whiteHRookHasMoved;
         m_blackARookHasMoved = other.m_blackARookHasMoved;
         m_blackHRookHasMoved = other.m_blackHRookHasMoved;
+
+        m_hash = other.m_hash;
     }
 
-    ChessBoard()
+    ChessBoard() :
+        m_hash(0)
     {
         setUpArrays();
     }
@@ -284,25 +318,355 @@ struct ChessBoard {
                 blackKingsBoard;
     }
 
-    void clearOppPieces(uint64_t bb)
+    uint64_t* pieceBoard(enum SimplePieceTypes piece, bool white)
     {
-        *oppPawns() = *oppPawns() & ~bb;
-        *oppKnights() = *oppKnights() & ~bb;
-        *oppBishops() = *oppBishops() & ~bb;
-        *oppRooks() = *oppRooks() & ~bb;
-        *oppQueens() = *oppQueens() & ~bb;
-        *oppKings() = *oppKings() & ~bb;
+        switch (piece)
+        {
+            case PIECE_PAWN:
+                return pawns[(int)white];
+            case PIECE_KNIGHT:
+                return knights[(int)white];
+            case PIECE_BISHOP:
+                return bishops[(int)white];
+            case PIECE_ROOK:
+                return rooks[(int)white];
+            case PIECE_QUEEN:
+                return queens[(int)white];
+            case PIECE_KING:
+            default:
+                return kings[(int)white];
+        }
+    }
+
+    // Zobrist key for a piece on a square. PieceTypes orders the king before the queen.
+    static uint64_t pieceKey(enum SimplePieceTypes piece, bool white, int sq)
+    {
+        constexpr int kZobristIndex[6] = { 0, 1, 2, 3, 5, 4 };
+        return g_zobrist.pieces[kZobristIndex[piece] + (white ? 0 : 6)][sq];
+    }
+
+    void moveMyPiece(enum SimplePieceTypes piece, uint64_t from, uint64_t to)
+    {
+        uint64_t* bb = pieceBoard(piece, m_isWhitesTurn);
+        *bb = (*bb & ~from) | to;
+        m_hash ^= pieceKey(piece, m_isWhitesTurn, __builtin_ctzll(from)) ^ pieceKey(piece, m_isWhitesTurn, __builtin_ctzll(to));
+    }
+
+    void addMyPiece(enum SimplePieceTypes piece, uint64_t to)
+    {
+        uint64_t* bb = pieceBoard(piece, m_isWhitesTurn);
+        *bb |= to;
+        m_hash ^= pieceKey(piece, m_isWhitesTurn, __builtin_ctzll(to));
+    }
+
+    // The piece of the given colour on a square, or -1 if there is none
+    int pieceOn(uint64_t bb, bool white) const
+    {
+        const uint64_t* boards[6] = { pawns[(int)white], knights[(int)white], bishops[(int)white],
+                                      rooks[(int)white], queens[(int)white], kings[(int)white] };
+
+        for (int piece = PIECE_PAWN; piece <= PIECE_KING; piece++)
+            if (*boards[piece] & bb) return piece;
+
+        return -1;
+    }
+
+    // Remove whatever opponent piece is on the square, returning its type or NO_CAPTURE
+    int clearOppPieces(uint64_t bb)
+    {
+        bool opp = !m_isWhitesTurn;
+        int sq = __builtin_ctzll(bb);
+
+        for (int piece = PIECE_PAWN; piece <= PIECE_KING; piece++)
+        {
+            uint64_t* b = pieceBoard((enum SimplePieceTypes)piece, opp);
+
+            if (*b & bb)
+            {
+                *b &= ~bb;
+                m_hash ^= pieceKey((enum SimplePieceTypes)piece, opp, sq);
+                return piece;
+            }
+        }
+
+        return UndoRecord::NO_CAPTURE;
+    }
+
+    // Set a castling flag, updating the hash if it changes
+    void setCastleFlag(bool& flag, enum ZobristCastleFlags idx)
+    {
+        if (!flag)
+        {
+            flag = true;
+            m_hash ^= g_zobrist.castling[idx];
+        }
+    }
+
+    void setMyKingHasMoved()
+    {
+        if (m_isWhitesTurn) setCastleFlag(m_whiteKingHasMoved, ZOBRIST_WHITE_KING_MOVED);
+        else setCastleFlag(m_blackKingHasMoved, ZOBRIST_BLACK_KING_MOVED);
+    }
+
+    void setMyARookHasMoved()
+    {
+        if (m_isWhitesTurn) setCastleFlag(m_whiteARookHasMoved, ZOBRIST_WHITE_A_ROOK_MOVED);
+        else setCastleFlag(m_blackARookHasMoved, ZOBRIST_BLACK_A_ROOK_MOVED);
+    }
+
+    void setMyHRookHasMoved()
+    {
+        if (m_isWhitesTurn) setCastleFlag(m_whiteHRookHasMoved, ZOBRIST_WHITE_H_ROOK_MOVED);
+        else setCastleFlag(m_blackHRookHasMoved, ZOBRIST_BLACK_H_ROOK_MOVED);
     }
 
     void nextTurn()
     {
         m_isWhitesTurn = !m_isWhitesTurn;
+        m_hash ^= g_zobrist.blackToMove;
+    }
+
+    uint8_t castleFlags() const
+    {
+        return  (m_whiteKingHasMoved  << ZOBRIST_WHITE_KING_MOVED) |
+                (m_blackKingHasMoved  << ZOBRIST_BLACK_KING_MOVED) |
+                (m_whiteARookHasMoved << ZOBRIST_WHITE_A_ROOK_MOVED) |
+                (m_whiteHRookHasMoved << ZOBRIST_WHITE_H_ROOK_MOVED) |
+                (m_blackARookHasMoved << ZOBRIST_BLACK_A_ROOK_MOVED) |
+                (m_blackHRookHasMoved << ZOBRIST_BLACK_H_ROOK_MOVED);
+    }
+
+    void setCastleFlags(uint8_t flags)
+    {
+        m_whiteKingHasMoved  = flags & (1 << ZOBRIST_WHITE_KING_MOVED);
+        m_blackKingHasMoved  = flags & (1 << ZOBRIST_BLACK_KING_MOVED);
+        m_whiteARookHasMoved = flags & (1 << ZOBRIST_WHITE_A_ROOK_MOVED);
+        m_whiteHRookHasMoved = flags & (1 << ZOBRIST_WHITE_H_ROOK_MOVED);
+        m_blackARookHasMoved = flags & (1 << ZOBRIST_BLACK_A_ROOK_MOVED);
+        m_blackHRookHasMoved = flags & (1 << ZOBRIST_BLACK_H_ROOK_MOVED);
+    }
+
+    static constexpr uint64_t kRookCorners = COORD_TO_BIT(A_FILE, FIRST_RANK)  | COORD_TO_BIT(H_FILE, FIRST_RANK) |
+                                             COORD_TO_BIT(A_FILE, EIGHTH_RANK) | COORD_TO_BIT(H_FILE, EIGHTH_RANK);
+
+    // A rook moving away from, or being captured on, its starting corner loses that castling right
+    void rookCornerTouched(uint64_t bb)
+    {
+        if (bb & COORD_TO_BIT(A_FILE, FIRST_RANK))  setCastleFlag(m_whiteARookHasMoved, ZOBRIST_WHITE_A_ROOK_MOVED);
+        if (bb & COORD_TO_BIT(H_FILE, FIRST_RANK))  setCastleFlag(m_whiteHRookHasMoved, ZOBRIST_WHITE_H_ROOK_MOVED);
+        if (bb & COORD_TO_BIT(A_FILE, EIGHTH_RANK)) setCastleFlag(m_blackARookHasMoved, ZOBRIST_BLACK_A_ROOK_MOVED);
+        if (bb & COORD_TO_BIT(H_FILE, EIGHTH_RANK)) setCastleFlag(m_blackHRookHasMoved, ZOBRIST_BLACK_H_ROOK_MOVED);
+    }
+
+    static enum SimplePieceTypes promotionPiece(enum MoveType type)
+    {
+        switch (type)
+        {
+            case PROMOTE_TO_ROOK:
+                return PIECE_ROOK;
+            case PROMOTE_TO_BISHOP:
+                return PIECE_BISHOP;
+            case PROMOTE_TO_KNIGHT:
+                return PIECE_KNIGHT;
+            case PROMOTE_TO_QUEEN:
+            default:
+                return PIECE_QUEEN;
+        }
+    }
+
+    static bool isPromotion(enum MoveType type)
+    {
+        return type >= PROMOTE_TO_QUEEN;
+    }
+
+    static bool isQuiet(enum MoveType type)
+    {
+        return type == BASIC_MOVE || type == CASTLE_KING_SIDE || type == CASTLE_QUEEN_SIDE;
+    }
+
+    // Square of the pawn taken by an en passant capture to "to"
+    uint64_t enPassantVictim(uint64_t to) const
+    {
+        return m_isWhitesTurn ? to >> 8 : to << 8;
+    }
+
+    // Make a move in place, as found by Chess::generateMovesFast(). Everything needed to take it
+    // back with unmakeMove() is saved in undo, which is much cheaper than copying the board.
+    void makeMove(enum SimplePieceTypes piece, uint64_t from, uint64_t to, enum MoveType type, UndoRecord& undo)
+    {
+        undo.hash          = m_hash;
+        undo.enPassantFile = m_can_en_passant_file;
+        undo.castleFlags   = castleFlags();
+        undo.capturedPiece = UndoRecord::NO_CAPTURE;
+
+        if (type == CAPTURE || isPromotion(type)) undo.capturedPiece = clearOppPieces(to);
+        else if (type == EN_PASSENT) undo.capturedPiece = clearOppPieces(enPassantVictim(to));
+
+        m_can_en_passant_file = INVALID_FILE;
+
+        switch (type)
+        {
+            case CASTLE_KING_SIDE:
+                moveMyPiece(PIECE_KING, from, to);
+                moveMyPiece(PIECE_ROOK, from << 3, from << 1);
+                break;
+            case CASTLE_QUEEN_SIDE:
+                moveMyPiece(PIECE_KING, from, to);
+                moveMyPiece(PIECE_ROOK, from >> 4, from >> 1);
+                break;
+            case PROMOTE_TO_QUEEN:
+            case PROMOTE_TO_ROOK:
+            case PROMOTE_TO_BISHOP:
+            case PROMOTE_TO_KNIGHT:
+                *myPawns() &= ~from;
+                m_hash ^= pieceKey(PIECE_PAWN, m_isWhitesTurn, __builtin_ctzll(from));
+                addMyPiece(promotionPiece(type), to);
+                break;
+            default:
+                moveMyPiece(piece, from, to);
+                break;
+        }
+
+        int fromSq = __builtin_ctzll(from);
+
+        switch (piece)
+        {
+            case PIECE_PAWN:
+                if (to == (from << 16) || to == (from >> 16)) m_can_en_passant_file = fromSq & 7;
+                break;
+            case PIECE_KING:
+                setMyKingHasMoved();
+                break;
+            default:
+                break;
+        }
+
+        if ((from | to) & kRookCorners) rookCornerTouched(from | to);
+
+        nextTurn();
+    }
+
+    void unmakeMove(enum SimplePieceTypes piece, uint64_t from, uint64_t to, enum MoveType type, const UndoRecord& undo)
+    {
+        m_isWhitesTurn = !m_isWhitesTurn;
+
+        switch (type)
+        {
+            case CASTLE_KING_SIDE:
+                *myKings() = (*myKings() & ~to) | from;
+                *myRooks() = (*myRooks() & ~(from << 1)) | (from << 3);
+                break;
+            case CASTLE_QUEEN_SIDE:
+                *myKings() = (*myKings() & ~to) | from;
+                *myRooks() = (*myRooks() & ~(from >> 1)) | (from >> 4);
+                break;
+            case PROMOTE_TO_QUEEN:
+            case PROMOTE_TO_ROOK:
+            case PROMOTE_TO_BISHOP:
+            case PROMOTE_TO_KNIGHT:
+                *pieceBoard(promotionPiece(type), m_isWhitesTurn) &= ~to;
+                *myPawns() |= from;
+                break;
+            default:
+            {
+                uint64_t* bb = pieceBoard(piece, m_isWhitesTurn);
+                *bb = (*bb & ~to) | from;
+                break;
+            }
+        }
+
+        if (undo.capturedPiece != UndoRecord::NO_CAPTURE)
+            *pieceBoard((enum SimplePieceTypes)undo.capturedPiece, !m_isWhitesTurn) |= (type == EN_PASSENT) ? enPassantVictim(to) : to;
+
+        m_can_en_passant_file = undo.enPassantFile;
+        setCastleFlags(undo.castleFlags);
+        m_hash = undo.hash;
+    }
+
+    // Pass, leaving the pieces where they are, for null move pruning
+    void makeNullMove(UndoRecord& undo)
+    {
+        undo.hash          = m_hash;
+        undo.enPassantFile = m_can_en_passant_file;
+
+        m_can_en_passant_file = INVALID_FILE;
+        nextTurn();
+    }
+
+    void unmakeNullMove(const UndoRecord& undo)
+    {
+        m_isWhitesTurn = !m_isWhitesTurn;
+        m_can_en_passant_file = undo.enPassantFile;
+        m_hash = undo.hash;
+    }
+
+    // Incrementally maintained Zobrist hash, including the en passant file
+    uint64_t hash() const
+    {
+        return m_hash ^ ((m_can_en_passant_file != INVALID_FILE) ? g_zobrist.enPassantFile[m_can_en_passant_file] : 0);
+    }
+
+    // Recompute the incremental hash from scratch, e.g. after setting up a position
+    void rehash()
+    {
+        m_hash = computeHash();
+        if (m_can_en_passant_file != INVALID_FILE) m_hash ^= g_zobrist.enPassantFile[m_can_en_passant_file];
+    }
+
+    // Compute the Zobrist hash of this position from scratch
+    uint64_t computeHash() const
+    {
+        // Ordered as the PieceTypes enum, to match the Zobrist piece index
+        const uint64_t boards[12] = {
+            whitePawnsBoard, whiteKnightsBoard, whiteBishopsBoard, whiteRooksBoard, whiteKingsBoard, whiteQueensBoard,
+            blackPawnsBoard, blackKnightsBoard, blackBishopsBoard, blackRooksBoard, blackKingsBoard, blackQueensBoard
+        };
+
+        uint64_t hash = 0;
+
+        for (int piece = 0; piece < 12; piece++)
+        {
+            for (uint64_t bb = boards[piece]; bb != 0; bb &= bb - 1)
+                hash ^= g_zobrist.pieces[piece][__builtin_ctzll(bb)];
+        }
+
+        if (!m_isWhitesTurn) hash ^= g_zobrist.blackToMove;
+
+        if (m_whiteKingHasMoved)  hash ^= g_zobrist.castling[ZOBRIST_WHITE_KING_MOVED];
+        if (m_blackKingHasMoved)  hash ^= g_zobrist.castling[ZOBRIST_BLACK_KING_MOVED];
+        if (m_whiteARookHasMoved) hash ^= g_zobrist.castling[ZOBRIST_WHITE_A_ROOK_MOVED];
+        if (m_whiteHRookHasMoved) hash ^= g_zobrist.castling[ZOBRIST_WHITE_H_ROOK_MOVED];
+        if (m_blackARookHasMoved) hash ^= g_zobrist.castling[ZOBRIST_BLACK_A_ROOK_MOVED];
+        if (m_blackHRookHasMoved) hash ^= g_zobrist.castling[ZOBRIST_BLACK_H_ROOK_MOVED];
+
+        if (m_can_en_passant_file != INVALID_FILE) hash ^= g_zobrist.enPassantFile[m_can_en_passant_file];
+
+        return hash;
     }
 
     std::vector<ChessMove> m_legalMoves;
 };
 
-class MagicBitboards;
+// Limits for getBestMove(). The search deepens iteratively until it runs out of time
+// or reaches maxDepth.
+struct SearchLimits {
+
+    static constexpr int kMaxDepth = 64;
+
+    SearchLimits() :
+        moveTimeMs(3000),
+        timeLeftMs(0),
+        incrementMs(0),
+        maxDepth(kMaxDepth)
+    {
+
+    }
+
+    int moveTimeMs;     // Fixed time per move. If zero, budget from timeLeftMs and incrementMs.
+    int timeLeftMs;     // Time remaining on our clock
+    int incrementMs;    // Increment per move
+    int maxDepth;
+};
 
 class Chess {
 
@@ -321,6 +685,10 @@ class Chess {
                               bool print = true, bool recompute_legal = false, PromotionType promote = NO_PROMOTION);
 
         void getBestMove(int& x1, int& y1, int& x2, int& y2, enum PromotionType& promote); 
+        void setSearchLimits(const SearchLimits& limits) { m_searchLimits = limits; }
+        void setSearchThreads(int threads) { m_searchThreads = std::max(threads, 1); }
+
+        bool setBoardFromFEN(const std::string& fen);
 
         void getLegalMovesForBoardAsVector(const ChessBoard& board, std::vector<ChessMove>& vec);
         void getLegalMovesForBoardAsVectorSlow(const ChessBoard& board, std::vector<ChessMove>& vec);
@@ -333,22 +701,56 @@ class Chess {
         std::uint64_t getWhitePawnAttacks(int sq) { return m_pawnAttacksWhite[sq]; }
         std::uint64_t getBlackPawnAttacks(int sq) { return m_pawnAttacksBlack[sq]; }
 
-        std::uint64_t perft(int depth);
+        // Count the leaf nodes of the move tree to the given depth. With bulk counting, the last
+        // ply counts the legal moves instead of making each of them.
+        std::uint64_t perft(int depth, bool bulk = false);
         std::uint64_t perftSlow(int depth);
 
+        // Perft broken down by root move, as "e2e4: 600" lines, for tracking down generator bugs
+        std::uint64_t perftDivide(int depth, std::vector<std::pair<std::string, std::uint64_t>>& divide, bool bulk = true);
+
+        // Perft split across threads. The tree is expanded until there are enough subtrees to keep
+        // every thread busy, and idle threads pull the next subtree from a shared queue.
+        std::uint64_t perftParallel(int depth, int threads, bool bulk = true);
+
+        // Size of the perft hash table in megabytes, 0 to count every subtree in full
+        void setPerftHashSize(std::size_t megabytes);
+
+        static std::string moveToString(uint64_t from, uint64_t to, enum MoveType type);
+
         bool moveIsPromotion(int x1, int y1, int x2, int y2);
 
     public:
 
-        std::uint64_t _perft(ChessBoard& board, int depth);
+        std::uint64_t _perft(ChessBoard& board, int depth, bool bulk = false);
         std::uint64_t _perftSlow(ChessBoard& board, int depth);
 
         void evalBoard(const ChessBoard& board, double& white_score, double& black_score);
         void evalBoardFaster(const ChessBoard& board, double& white_score, double& black_score, bool noMoves = false);
 
         double minimaxAlphaBeta(const ChessBoard& board, bool white, ChessMove& move, bool maximizing, int depth, uint64_t& npos, double alpha, double beta);
-        double minimaxAlphaBetaFaster(ChessBoard& board, bool white, ChessMove& move, bool maximizing, int depth, uint64_t& npos, double alpha, double beta);
-
+        double minimaxAlphaBetaFaster(ChessBoard& board, bool white, ChessMove& move, bool maximizing, int depth, uint64_t& npos, double alpha, double beta, int ply = 0);
+
+        // Negamax principal variation search, scores are from the side to move's point of view:
+        // https://www.chessprogramming.org/Principal_Variation_Search
+        double principalVariationSearch(ChessBoard& board, ChessMove& move, int depth, uint64_t& npos, double alpha, double beta,
+                                        int ply = 0, bool allowNullMove = true);
+
+        double quiescence(ChessBoard& board, bool white, bool maximizing, double alpha, double beta, int ply);
+
+        // Static exchange evaluation: the material won or lost, in centipawns, if both sides keep
+        // capturing on the target square with their least valuable piece for as long as it pays.
+        // Pins and checks are ignored. https://www.chessprogramming.org/Static_Exchange_Evaluation
+        static constexpr int kSeeValues[] = { 100, 300, 300, 500, 900, 20000 };
+        int see(const ChessBoard& board, uint64_t from, uint64_t to, enum MoveType type);
+
+        // Generate legal moves. Each move is made on the board in turn and passed to
+        // func(board, from, to, type), which returns true to stop generating. The template lets
+        // the compiler inline the callback; the std::function overload is kept for convenience.
+        // With MakeMoves false, func is called with the board unchanged, which is enough for counting.
+        // En passant is still made to test its legality, but is taken back before func sees it.
+        template <bool MakeMoves = true, enum MoveGenType Gen = GEN_ALL, typename Func>
+        void generateMovesFast(ChessBoard& board, Func&& func, bool& oppKingDead);
         void generateMovesFast(ChessBoard& board, std::function<bool (ChessBoard& b, uint64_t, uint64_t, enum MoveType type)>, bool& oppKingDead);
 
         bool movePutsPlayerInCheck(const ChessBoard& board, int x1, int y1, int x2, int y2, bool white);
@@ -361,8 +763,6 @@ class Chess {
         void removePieceFromSquare       (ChessBoard& board, enum PieceTypes type, int x, int y);
         void addPieceToSquare            (ChessBoard& board, enum PieceTypes type, int x, int y);
 
-        void computeBlockersAndBeyond();
-
         double sum_bits_and_multiply(uint64_t bb, double multiplier);
         double multiply_bits_with_weights(uint64_t bb, const double* weights);
         double multiply_bits_with_weights_reverse(uint64_t bb, const double* weights);
@@ -389,6 +789,43 @@ class Chess {
             return moves;
         }
 
+        bool sideToMoveInCheck(const ChessBoard& board)
+        {
+            uint64_t king = board.m_isWhitesTurn ? board.whiteKingsBoard : board.blackKingsBoard;
+            uint64_t occupied = board.allWhitePieces() | board.allBlackPieces();
+
+            return attackersOf(board, bitScanForward(king), !board.m_isWhitesTurn, occupied) != 0;
+        }
+
+        // Pieces of one colour attacking a square. Sliders are blocked by the given occupancy.
+        uint64_t attackersOf(const ChessBoard& board, int sq, bool white, uint64_t occupied)
+        {
+            uint64_t attackers;
+            uint64_t diagonal;
+            uint64_t straight;
+
+            if (white)
+            {
+                attackers = (m_pawnAttacksBlack[sq] & board.whitePawnsBoard) |
+                            (m_pieceMoves[PIECE_KNIGHT][sq] & board.whiteKnightsBoard) |
+                            (m_pieceMoves[PIECE_KING][sq] & board.whiteKingsBoard);
+                diagonal  = board.whiteBishopsBoard | board.whiteQueensBoard;
+                straight  = board.whiteRooksBoard | board.whiteQueensBoard;
+            }
+            else
+            {
+                attackers = (m_pawnAttacksWhite[sq] & board.blackPawnsBoard) |
+                            (m_pieceMoves[PIECE_KNIGHT][sq] & board.blackKnightsBoard) |
+                            (m_pieceMoves[PIECE_KING][sq] & board.blackKingsBoard);
+                diagonal  = board.blackBishopsBoard | board.blackQueensBoard;
+                straight  = board.blackRooksBoard | board.blackQueensBoard;
+            }
+
+            return attackers |
+                   (m_magicbb->bishopAttacks(sq, occupied) & diagonal) |
+                   (m_magicbb->rookAttacks(sq, occupied) & straight);
+        }
+
         void moveFromBitboards(ChessMove& move, uint64_t from, uint64_t to, enum MoveType type)
         {
             int fromSq = bitScanForward(from);
@@ -420,6 +857,12 @@ class Chess {
 
         } 
 
+        // Pack a move into 16 bits for storing in the transposition table
+        static uint16_t packMove(uint64_t from, uint64_t to, enum MoveType type)
+        {
+            return bitScanForward(from) | (bitScanForward(to) << 6) | (type << 12);
+        }
+
         ChessBoard m_board;
 
         std::uint64_t m_totalCheckTestMicroseconds;
@@ -428,16 +871,429 @@ class Chess {
         std::uint64_t m_totalGenLegalMicroseconds;
 
         // Lookup tables for "blockers and beyond": https://www.chessprogramming.org/Blockers_and_Beyond
-        std::uint64_t m_pieceMoves[6][64];
-        std::uint64_t m_arrBlockersAndBeyond[6][64];
-        std::uint64_t m_arrBehind[64][64];
-        std::uint64_t m_pawnMovesWhite[64];
-        std::uint64_t m_pawnMovesBlack[64];
-        std::uint64_t m_pawnAttacksWhite[64];
-        std::uint64_t m_pawnAttacksBlack[64];
+        // These point into the process-wide AttackTables.
+        const std::uint64_t (*m_pieceMoves)[64];
+        const std::uint64_t (*m_arrBlockersAndBeyond)[64];
+        const std::uint64_t (*m_arrBehind)[64];
+        const std::uint64_t (*m_arrBetween)[64];     // Squares strictly between two squares on a line
+        const std::uint64_t (*m_arrLine)[64];        // The whole line through two squares
+        const std::uint64_t* m_pawnMovesWhite;
+        const std::uint64_t* m_pawnMovesBlack;
+        const std::uint64_t* m_pawnAttacksWhite;
+        const std::uint64_t* m_pawnAttacksBlack;
 
         int m_nEnPassents;
 
-        Blockers m_blockers;
-        MagicBitboards* m_magicbb;
+        const MagicBitboards* m_magicbb;
+
+        // Shared between the search threads, see getBestMove()
+        std::shared_ptr<TranspositionTable> m_tt;
+        bool m_useTranspositionTable;
+
+        // Resolve captures at the horizon instead of evaluating there directly
+        bool m_useQuiescence;
+
+        // Search with principalVariationSearch() rather than minimaxAlphaBetaFaster()
+        bool m_usePVS;
+
+        // Null move pruning in principalVariationSearch(), can be turned off to check its results
+        bool m_useNullMove;
+        std::uint64_t m_nullMoveTries;
+        std::uint64_t m_nullMoveCutoffs;
+
+        // Late move reductions in principalVariationSearch(). The counts are for the last iteration.
+        bool m_useLMR;
+        std::uint64_t m_lmrReductions;
+        std::uint64_t m_lmrReSearches;
+
+        // Futility pruning, reverse futility pruning and razoring near the horizon
+        bool m_useFutility;
+        std::uint64_t m_futilityPrunes;             // Moves skipped
+        std::uint64_t m_reverseFutilityPrunes;      // Nodes cut off
+        std::uint64_t m_razorPrunes;                // Nodes cut off
+
+        // Half width of the root window around the last iteration's score, 0 for a full window
+        double m_aspirationWindow;
+
+        // Subtree counts for perft, null when disabled
+        std::shared_ptr<PerftCache> m_perftCache;
+
+        std::uint64_t m_ttProbes;
+        std::uint64_t m_ttHits;
+        std::uint64_t m_ttStores;
+
+        // Quiet moves that caused cutoffs, used by MovePicker to order the quiet moves.
+        // Killers are the last two cutoff moves at each ply: https://www.chessprogramming.org/Killer_Heuristic
+        // History counts cutoffs by side, from and to square: https://www.chessprogramming.org/History_Heuristic
+        // Each search thread has its own copy.
+        static constexpr int kMaxPly = 128;
+        static constexpr int kHistoryMax = 1 << 20;
+
+        std::uint16_t m_killers[kMaxPly][2];
+        int m_history[2][64][64];
+
+        // Triangular PV table: https://www.chessprogramming.org/Triangular_PV-Table
+        // Row ply holds the best line found from that ply, m_pvLength[ply] is where it ends. The
+        // line stops short where a transposition table hit ended the search, extendPVFromTT() fills in the rest.
+        // m_principalVariation is the line from the last completed iteration, and the next
+        // iteration searches it first while m_followPV is set.
+        std::uint16_t m_pvTable[kMaxPly][kMaxPly];
+        int m_pvLength[kMaxPly];
+        std::vector<std::uint16_t> m_principalVariation;
+        bool m_followPV;
+
+        void updatePV(int ply, std::uint16_t move);
+        void extendPVFromTT(int depth);
+        bool moveIsLegal(ChessBoard& board, std::uint16_t move);
+        std::string pvToString() const;
+
+        void updateQuietHistory(bool white, std::uint16_t move, int depth, int ply);
+        void ageQuietHistory();
+        void clearKillers();
+
+        SearchLimits m_searchLimits;
+        std::chrono::steady_clock::time_point m_searchDeadline;
+        bool m_stopSearch;
+        int m_completedDepth;
+        std::uint64_t m_searchNodes;
+        std::uint64_t m_qsearchNodes;   // Counted separately from the main search nodes
+
+        int m_searchThreads;
+        const std::atomic<bool>* m_stopHelpers;   // Set by the main thread to stop helper threads
+
+        int timeBudgetMs();
+
+        double searchIterations(ChessMove& bestMove, int firstDepth, int budget, 
+                                std::chrono::steady_clock::time_point startTime, bool mainThread);
+
+        void checkSearchTime()
+        {
+            if (std::chrono::steady_clock::now() >= m_searchDeadline) m_stopSearch = true;
+            if (m_stopHelpers && m_stopHelpers->load(std::memory_order_relaxed)) m_stopSearch = true;
+        }
 };
+
+template <bool MakeMoves, enum MoveGenType Gen, typename Func>
+void Chess::generateMovesFast(ChessBoard& board, Func&& func, bool& oppKingDead)
+{
+
+    uint64_t myPieces  = 0;
+    uint64_t oppPieces = 0;
+    uint64_t allPieces = 0;
+    const uint64_t *myPawnAttacks;
+    const uint64_t *myPawnMoves;
+    uint64_t enPassentSq;
+    uint64_t kingMoveSquares = 0;
+    uint64_t promoteBitmask = 0;    
+    uint64_t castleRank = 0;
+
+    CHECK_ZOBRIST(board);
+
+    // Make each move in place, hand the board to func, then take the move back
+    auto visit = [&] (enum SimplePieceTypes piece, uint64_t from, uint64_t to, enum MoveType type)
+    {
+        if constexpr (!MakeMoves) return func(board, from, to, type);
+
+        UndoRecord undo;
+
+        board.makeMove(piece, from, to, type, undo);
+        bool stop = func(board, from, to, type);
+        board.unmakeMove(piece, from, to, type, undo);
+
+        return stop;
+    };
+
+    if (board.m_isWhitesTurn)
+    {
+        myPieces     = board.allWhitePieces();
+        oppPieces    = board.allBlackPieces();
+        allPieces    = board.allWhitePieces() | board.allBlackPieces();
+        myPawnMoves     = m_pawnMovesWhite;
+        myPawnAttacks   = m_pawnAttacksWhite;
+        if (board.m_can_en_passant_file != INVALID_FILE)
+        {
+            enPassentSq             = COORD_TO_BIT(board.m_can_en_passant_file, SIXTH_RANK);
+        }
+        else
+        {
+            enPassentSq         = 0;
+        }
+        promoteBitmask = 0xff00'0000'0000'0000;    
+        castleRank = FIRST_RANK;
+    }
+    else
+    {
+        myPieces     = board.allBlackPieces();
+        oppPieces    = board.allWhitePieces();
+        allPieces    = board.allWhitePieces() | board.allBlackPieces();
+        myPawnMoves     = m_pawnMovesBlack;
+        myPawnAttacks   = m_pawnAttacksBlack;
+
+        if (board.m_can_en_passant_file != INVALID_FILE)
+        {
+            enPassentSq             = COORD_TO_BIT(board.m_can_en_passant_file, THIRD_RANK);
+        }
+        else
+        {
+            enPassentSq         = 0;
+        }
+        promoteBitmask = 0x0000'0000'0000'00ff;    
+        castleRank = EIGHTH_RANK;
+    }
+
+    // Work out checks and pins once, so that only legal moves are generated:
+    // https://www.chessprogramming.org/Checks_and_Pinned_Pieces_(Bitboards)
+
+    bool white = board.m_isWhitesTurn;
+    uint64_t myKing = *board.myKings();
+    int myKingSq = bitScanForward(myKing);
+    uint64_t checkers = attackersOf(board, myKingSq, !white, allPieces);
+
+    // Squares a piece other than the king must move to: anywhere when not in check, onto the
+    // checker or in between when in check from one piece, and nowhere in double check
+    uint64_t checkMask = ~0ULL;
+
+    if (checkers)
+        checkMask = (checkers & (checkers - 1)) ? 0 : (checkers | m_arrBetween[myKingSq][bitScanForward(checkers)]);
+
+    // A piece alone between the king and an enemy slider is pinned, and may only move along the line
+    uint64_t pinned = 0;
+    uint64_t oppDiagonal = white ? (board.blackBishopsBoard | board.blackQueensBoard) : (board.whiteBishopsBoard | board.whiteQueensBoard);
+    uint64_t oppStraight = white ? (board.blackRooksBoard | board.blackQueensBoard) : (board.whiteRooksBoard | board.whiteQueensBoard);
+    uint64_t snipers = (m_magicbb->bishopAttacks(myKingSq, oppPieces) & oppDiagonal) | 
+                       (m_magicbb->rookAttacks(myKingSq, oppPieces) & oppStraight);
+
+    for (; snipers != 0; snipers &= snipers - 1)
+    {
+        uint64_t between = m_arrBetween[myKingSq][bitScanForward(snipers)] & allPieces;
+
+        if ((between & (between - 1)) == 0) pinned |= between & myPieces;
+    }
+
+    // Restrict the target squares to captures or to empty squares for staged generation
+    uint64_t genMask = (Gen == GEN_CAPTURES) ? oppPieces : (Gen == GEN_QUIETS) ? ~oppPieces : ~0ULL;
+
+    auto legalTargets = [&] (uint64_t piece, int sq)
+    {
+        return ((piece & pinned) ? (checkMask & m_arrLine[myKingSq][sq]) : checkMask) & genMask;
+    };
+
+   // King moves
+
+    for (uint64_t bb = myKing; bb != 0; bb &= bb - 1)
+    {
+        uint64_t king = bb & -bb;
+        int kingSq = bitScanForward(king);
+        uint64_t moves = m_pieceMoves[PIECE_KING][kingSq];
+
+        moves &= ~myPieces & genMask;
+
+        for (; moves != 0; moves &= moves - 1)
+        {
+            uint64_t mm = moves & -moves;
+
+            // The king can't hide from a slider by stepping back along the line of attack
+            if (attackersOf(board, bitScanForward(mm), !white, allPieces ^ king)) continue;
+
+            if (visit(PIECE_KING, king, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+
+        }
+
+    }
+
+    // Castling. The king may not castle out of, through or into check.
+
+    if (Gen != GEN_CAPTURES && !checkers && !*board.myKingHasMoved())
+    {
+        if (!*board.myHRookHasMoved() && 
+            (allPieces & (COORD_TO_BIT(F_FILE, castleRank) | COORD_TO_BIT(G_FILE, castleRank))) == 0 &&
+            !attackersOf(board, F_FILE + castleRank * 8, !white, allPieces) &&
+            !attackersOf(board, G_FILE + castleRank * 8, !white, allPieces))
+        {
+            kingMoveSquares |= COORD_TO_BIT(G_FILE, castleRank); 
+        }
+
+        if (!*board.myARookHasMoved() && 
+            (allPieces & (COORD_TO_BIT(D_FILE, castleRank) | COORD_TO_BIT(C_FILE, castleRank) | COORD_TO_BIT(B_FILE, castleRank))) == 0 &&
+            !attackersOf(board, D_FILE + castleRank * 8, !white, allPieces) &&
+            !attackersOf(board, C_FILE + castleRank * 8, !white, allPieces))
+        {
+            kingMoveSquares |= COORD_TO_BIT(C_FILE, castleRank);
+        }
+    }
+
+    for (; kingMoveSquares != 0; kingMoveSquares &= kingMoveSquares - 1)
+    {
+        uint64_t mm = kingMoveSquares & -kingMoveSquares;
+
+        enum MoveType type = (mm & (COORD_TO_BIT(G_FILE, FIRST_RANK) | COORD_TO_BIT(G_FILE, EIGHTH_RANK))) ? CASTLE_KING_SIDE : CASTLE_QUEEN_SIDE;
+
+        if (visit(PIECE_KING, myKing, mm, type)) goto done;
+    }
+
+    // Pawn moves
+    for (uint64_t bb = *board.myPawns(); bb != 0; bb &= bb - 1)
+    {
+        uint64_t pawn = bb & -bb;
+        int pawnSq = bitScanForward(pawn);
+        uint64_t targets = (pawn & pinned) ? (checkMask & m_arrLine[myKingSq][pawnSq]) : checkMask;
+
+        uint64_t m = myPawnMoves[pawnSq];
+        for (uint64_t mb = m & allPieces; mb != 0; mb &= (mb - 1))
+        {
+            int sq = bitScanForward(mb);
+            m &= ~m_arrBehind[pawnSq][sq];
+        }
+      
+        m &= ~allPieces;
+
+        // Promotions count as captures for staged generation
+        if (Gen == GEN_CAPTURES) m &= promoteBitmask;
+        if (Gen == GEN_QUIETS)   m &= ~promoteBitmask;
+
+        // Pawn captures
+        if (Gen != GEN_QUIETS) m |= myPawnAttacks[pawnSq] & oppPieces;
+
+        m &= targets;
+
+        for (; m != 0; m &= (m-1))
+        {
+            uint64_t mm = m & -m;
+            if (mm & promoteBitmask)
+            {
+                // Generate promote to queen
+                if (visit(PIECE_PAWN, pawn, mm, PROMOTE_TO_QUEEN)) goto done;
+
+                // Generate promote to rook
+                if (visit(PIECE_PAWN, pawn, mm, PROMOTE_TO_ROOK)) goto done;
+
+                // Generate promote to bishop
+                if (visit(PIECE_PAWN, pawn, mm, PROMOTE_TO_BISHOP)) goto done;
+
+                // Generate promote to knight
+                if (visit(PIECE_PAWN, pawn, mm, PROMOTE_TO_KNIGHT)) goto done;
+            }
+            else
+            {
+                if (visit(PIECE_PAWN, pawn, mm, (mm & oppPieces) ? CAPTURE : BASIC_MOVE)) goto done;
+            }
+        }
+
+        // En passents. Two pawns leave the rank at once, which the pin test above can't see,
+        // so try the move and look for check.
+
+        m = myPawnAttacks[pawnSq];
+
+        m &= (Gen != GEN_QUIETS) ? enPassentSq : 0;
+
+        if (m)
+        {
+            UndoRecord undo;
+
+            board.makeMove(PIECE_PAWN, pawn, m, EN_PASSENT, undo);
+            bool legal = !attackersOf(board, myKingSq, !white, board.allWhitePieces() | board.allBlackPieces());
+            bool stop;
+
+            // Callers that don't make moves expect the board as it was
+            if constexpr (MakeMoves)
+            {
+                stop = legal && func(board, pawn, m, EN_PASSENT);
+                board.unmakeMove(PIECE_PAWN, pawn, m, EN_PASSENT, undo);
+            }
+            else
+            {
+                board.unmakeMove(PIECE_PAWN, pawn, m, EN_PASSENT, undo);
+                stop = legal && func(board, pawn, m, EN_PASSENT);
+            }
+
+            if (stop) goto done;
+        }
+    }    
+
+
+    // Knight moves
+
+    for (uint64_t bb = *board.myKnights(); bb != 0; bb &= bb - 1)
+    {
+        uint64_t knight = bb & -bb;
+        int knightSq = bitScanForward(knight);
+        uint64_t moves = m_pieceMoves[PIECE_KNIGHT][knightSq];
+
+        moves &= ~myPieces & legalTargets(knight, knightSq);
+
+        for (; moves != 0; moves &= moves - 1)
+        {
+            uint64_t mm = moves & -moves;
+
+            if (visit(PIECE_KNIGHT, knight, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+
+        }
+
+    }
+    
+    // Bishop moves
+
+    for (uint64_t bb = *board.myBishops(); bb != 0; bb &= bb - 1)
+    {
+        uint64_t bishop = bb & -bb;
+        int bishopSq = bitScanForward(bishop);
+        uint64_t moves = m_magicbb->pieceAttacks(PIECE_BISHOP, bishopSq, allPieces);
+
+        moves &= ~myPieces & legalTargets(bishop, bishopSq);
+
+        for (; moves != 0; moves &= moves - 1)
+        {
+            uint64_t mm = moves & -moves;
+
+            if (visit(PIECE_BISHOP, bishop, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+
+        }
+
+    }
+
+    // Rook moves
+
+    for (uint64_t bb = *board.myRooks(); bb != 0; bb &= bb - 1)
+    {
+        uint64_t rook = bb & -bb;
+        int rookSq = bitScanForward(rook);
+        uint64_t moves = m_magicbb->pieceAttacks(PIECE_ROOK, rookSq, allPieces);
+
+        moves &= ~myPieces & legalTargets(rook, rookSq);
+
+        for (; moves != 0; moves &= moves - 1)
+        {
+            uint64_t mm = moves & -moves;
+
+            if (visit(PIECE_ROOK, rook, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+
+        }
+
+    }
+
+    // Queen moves
+
+    for (uint64_t bb = *board.myQueens(); bb != 0; bb &= bb - 1)
+    {
+        uint64_t queen = bb & -bb;
+        int queenSq = bitScanForward(queen);
+        uint64_t moves = m_magicbb->pieceAttacks(PIECE_QUEEN, queenSq, allPieces);
+
+        moves &= ~myPieces & legalTargets(queen, queenSq);
+
+        for (; moves != 0; moves &= moves - 1)
+        {
+            uint64_t mm = moves & -moves;
+
+            if (visit(PIECE_QUEEN, queen, mm, mm & oppPieces ? CAPTURE : BASIC_MOVE)) goto done;
+
+        }
+
+    }
+
+done:
+
+    oppKingDead = (board.oppKings() == 0);
+
+    return;
+}
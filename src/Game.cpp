@@ -36,6 +36,7 @@ Game::Game()    :
     m_threadExit{0},
     m_u(&m_r, &m_ch)
 {
+    m_ch.setSearchThreads(std::thread::hardware_concurrency());
 
     // Create our game thread
     m_chessThread = std::thread([](void* a) { Game* g = (Game*)a; g->chessThread(); }, this);
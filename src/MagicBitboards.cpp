@@ -30,6 +30,13 @@ SOFTWARE.
 */
 
 #include <MagicBitboards.h>
+#include <MagicNumbers.h>
+
+#include <cstdlib>
+#include <cstdio>
+#include <cassert>
+#include <vector>
+#include <utility>
 
 std::vector<std::pair<int, int>> bishop_moves = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1}};
 std::vector<std::pair<int, int>> rook_moves   = {{1, 0}, {-1, 0}, { 0, 1},  {0, -1}};
@@ -104,12 +111,12 @@ int MagicBitboards::population_count(uint64_t bb)
     return sum;
 }
 
-bool MagicBitboards::testMagic(Blockers* ch, int sq, bool rook, uint64_t bb, uint64_t magic)
+bool MagicBitboards::testMagic(const Blockers* ch, int sq, bool rook, const SquareMagic& m)
 {
 
-    // Count bits in bb
+    // Count bits in the occupancy mask
 
-    int count = population_count(bb);
+    int count = population_count(m.mask);
 
     int used[4096] = {0};
 
@@ -120,7 +127,7 @@ bool MagicBitboards::testMagic(Blockers* ch, int sq, bool rook, uint64_t bb, uin
         uint64_t occupied_bb = 0;
         int j = i;
 
-        for (uint64_t b = bb; b != 0; b &= b - 1)
+        for (uint64_t b = m.mask; b != 0; b &= b - 1)
         {
             uint64_t bit = b & -b;
 
@@ -129,104 +136,80 @@ bool MagicBitboards::testMagic(Blockers* ch, int sq, bool rook, uint64_t bb, uin
             j >>= 1;
         } 
    
-        // Multiply by magic
-   
-        uint64_t mult = occupied_bb * magic; 
-
-        //if (population_count(mult & 0xff00'0000'0000'0000) < 6) return false;
-
-        // Shift by bits in occupancy set
+        // Multiply by magic and keep the top bits. The binary counter enumerates the subsets
+        // in PEXT order, so with PEXT the index is just the counter.
 
-        //mult >>= (64 - count);
+        uint64_t idx = m_usePext ? (i & ((1 << count) - 1)) : (occupied_bb * m.magic) >> m.shift; 
 
-        if (rook)
-            mult >>= (64 - 12);
-        else
-            mult >>= (64 - 9);
+        uint64_t attacks = ch->pieceAttacks(rook ? PIECE_ROOK : PIECE_BISHOP, sq, occupied_bb);
+        uint64_t* lut    = rook ? &rook_lut[m.offset] : &bishop_lut[m.offset];
 
-        if (used[mult] == 0) 
-            used[mult] = i;
-        else if (used[mult] != i) 
-            return false;
-
-        if (rook)
-        {
-            // Compute rook attack set and store in the table
-            uint64_t a = ch->pieceAttacks(PIECE_ROOK, sq, occupied_bb);
-            rook_lut[mult][sq] = a;
-        }
-        else
+        // Occupancy sets may share an entry if they have the same attack set
+        if (used[idx] == 0) 
         {
-            // Compute bishop attack set and store in the table
-            uint64_t a = ch->pieceAttacks(PIECE_BISHOP, sq, occupied_bb);
-            bishop_lut[mult][sq] = a;
+            used[idx] = i;
+            lut[idx]  = attacks;
         }
+        else if (lut[idx] != attacks) 
+            return false;
 
     }
 
     return true;
 }
 
-uint64_t MagicBitboards::random_uint64_t() {
-  uint64_t u1, u2, u3, u4;
-  u1 = (uint64_t)(random()) & 0xFFFF; u2 = (uint64_t)(random()) & 0xFFFF;
-  u3 = (uint64_t)(random()) & 0xFFFF; u4 = (uint64_t)(random()) & 0xFFFF;
-  return u1 | (u2 << 16) | (u3 << 32) | (u4 << 48);
-}
-
-uint64_t MagicBitboards::random_uint64_t_fewbits() {
-  return random_uint64_t() & random_uint64_t() & random_uint64_t();
-}
+void MagicBitboards::computeTables(const Blockers* ch, bool allowPext)
+{
+    // The magics are precomputed by the magic/ tool, so this just fills the attack tables
 
+#ifdef MAGIC_BITBOARDS_PEXT
+    m_usePext = allowPext && __builtin_cpu_supports("bmi2");
+#else
+    (void)allowPext;
+    m_usePext = false;
+#endif
 
-void MagicBitboards::computeTables(Blockers* ch)
-{
+    uint32_t offset = 0;
 
     for (int sq = 0; sq < 64; sq++)
     {
-        uint64_t bb = get_rook_occupancy_set_for_square(sq);
+        SquareMagic& m = rook_magics[sq];
 
-        rook_occupancy[sq] = bb;
+        m.mask   = get_rook_occupancy_set_for_square(sq);
+        m.magic  = kRookMagics[sq];
+        m.shift  = 64 - population_count(m.mask);
+        m.offset = offset;
 
-        while (true)
-        {
-            uint64_t magic =  random_uint64_t_fewbits(); //0x100420000431024ULL; //gen64BitMagicNumber();
-    
-            if (testMagic(ch, sq, true, bb, magic))
-            {
-                //printf("Magic found for rook on sq %d %lx, bb = %lx\n", sq, magic, bb);
-                //return 0;
-                rook_magics[sq] = magic;
-                break;
-            }
+        offset += 1U << (64 - m.shift);
 
+        if (!testMagic(ch, sq, true, m))
+        {
+            fprintf(stderr, "Bad rook magic for square %d\n", sq);
+            abort();
         }
-
     }
 
-    // Compute magics for bishops
+    assert(offset == kRookTableSize);
+
+    offset = 0;
 
     for (int sq = 0; sq < 64; sq++)
     {
-        uint64_t bb = get_bishop_occupancy_set_for_square(sq);
+        SquareMagic& m = bishop_magics[sq];
 
-        bishop_occupancy[sq] = bb;
+        m.mask   = get_bishop_occupancy_set_for_square(sq);
+        m.magic  = kBishopMagics[sq];
+        m.shift  = 64 - population_count(m.mask);
+        m.offset = offset;
 
-        while (true)
-        {
-            uint64_t magic =  random_uint64_t_fewbits(); //0x100420000431024ULL; //gen64BitMagicNumber();
-    
-            if (testMagic(ch, sq, false, bb, magic))
-            {
-                //printf("Magic found for bishop on sq %d %lx\n", sq, magic);
-                //return 0;
-                bishop_magics[sq] = magic;
-                break;
-            }
+        offset += 1U << (64 - m.shift);
 
+        if (!testMagic(ch, sq, false, m))
+        {
+            fprintf(stderr, "Bad bishop magic for square %d\n", sq);
+            abort();
         }
-
     }
 
+    assert(offset == kBishopTableSize);
 }
-
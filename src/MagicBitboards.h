@@ -31,16 +31,42 @@ SOFTWARE.
 
 #pragma once
 
-#include <Chess.h>
+#include <cstdint>
+
+#include <Pieces.h>
 #include <Blockers.h>
 
+// "Fancy" magic bitboards: https://www.chessprogramming.org/Magic_Bitboards#Fancy
+//
+// Each square's attack sets are packed contiguously in one table, indexed with as many bits
+// as the square has relevant occupancy bits, so a square's entries share cache lines and pages.
+
+// Building with -DUSE_PEXT adds a BMI2 backend: the table index is _pext_u64(occupied, mask)
+// instead of the magic multiply and shift, using the same table layout. It is only used if
+// the CPU reports BMI2 at run time, so the binary still runs everywhere. Note that PEXT is
+// microcoded and slow on AMD before Zen 3.
+
+#if defined(USE_PEXT) && defined(__x86_64__)
+#define MAGIC_BITBOARDS_PEXT
+#endif
+
+struct SquareMagic {
+    uint64_t mask;      // Relevant occupancy bits
+    uint64_t magic;
+    uint32_t offset;    // Start of this square's attack sets in the table
+    uint32_t shift;     // 64 - popcount(mask)
+};
+
 class MagicBitboards {
 
     public:
 
-        void computeTables(Blockers* ch);
+        // allowPext = false forces the magic backend even if PEXT is available
+        void computeTables(const Blockers* ch, bool allowPext = true);
 
-        uint64_t pieceAttacks(enum SimplePieceTypes piece, int sq, uint64_t occupied)
+        bool usingPext() const { return m_usePext; }
+
+        uint64_t pieceAttacks(enum SimplePieceTypes piece, int sq, uint64_t occupied) const
         {
             switch (piece)
             {
@@ -54,42 +80,54 @@ class MagicBitboards {
             return 0;
         }
 
-        uint64_t rookAttacks(int sq, uint64_t occupied)
+        uint64_t rookAttacks(int sq, uint64_t occupied) const
         {
-            uint64_t b = occupied & rook_occupancy[sq];
-            uint64_t bits = (b * rook_magics[sq]) >> 64 - 12;
-            return rook_lut[bits][sq];   
+            const SquareMagic& m = rook_magics[sq];
+            return rook_lut[m.offset + index(m, occupied)];
         }
 
-        uint64_t bishopAttacks(int sq, uint64_t occupied)
+        uint64_t bishopAttacks(int sq, uint64_t occupied) const
         {
-            uint64_t b = occupied & bishop_occupancy[sq];
-            uint64_t bits = (b * bishop_magics[sq]) >> 64 - 9;
-            return bishop_lut[bits][sq];   
+            const SquareMagic& m = bishop_magics[sq];
+            return bishop_lut[m.offset + index(m, occupied)];
         }
 
+        // Total number of attack sets, i.e. the sum over squares of 2^popcount(mask)
+        static constexpr int kRookTableSize   = 102400;
+        static constexpr int kBishopTableSize = 5248;
+
 
     private:
 
+        uint64_t index(const SquareMagic& m, uint64_t occupied) const
+        {
+#ifdef MAGIC_BITBOARDS_PEXT
+            if (m_usePext)
+            {
+                // Inline asm rather than _pext_u64 so that the rest of the build doesn't need -mbmi2
+                uint64_t idx;
+                asm("pextq %2, %1, %0" : "=r" (idx) : "r" (occupied), "r" (m.mask));
+                return idx;
+            }
+#endif
+            return ((occupied & m.mask) * m.magic) >> m.shift;
+        }
 
         uint64_t get_bishop_occupancy_set_for_square(int sq);
         uint64_t get_rook_occupancy_set_for_square(int sq);
         int      population_count(uint64_t bb);
-        bool     testMagic(Blockers* ch, int sq, bool rook, uint64_t bb, uint64_t magic);
-        uint64_t random_uint64_t();
-        uint64_t random_uint64_t_fewbits();
+        bool     testMagic(const Blockers* ch, int sq, bool rook, const SquareMagic& m);
 
 
     private:
 
-        uint64_t bishop_magics[64];
-        uint64_t rook_magics[64];
+        SquareMagic bishop_magics[64];
+        SquareMagic rook_magics[64];
 
-        uint64_t bishop_occupancy[64];
-        uint64_t rook_occupancy[64];
+        uint64_t bishop_lut[kBishopTableSize];
+        uint64_t rook_lut[kRookTableSize];
 
-        uint64_t bishop_lut[512][64];
-        uint64_t rook_lut[4096][64];
+        bool m_usePext = false;
 
 };
 
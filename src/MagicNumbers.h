@@ -0,0 +1,76 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+MagicNumbers.h: Precomputed magic numbers for the slider attack tables
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+
+// Generated offline by the magic/ tool, which uses a fixed seed.
+// Each magic hashes the square's occupancy sets into popcount(mask) bits; occupancy sets with the
+// same attack set may share an index.
+
+constexpr uint64_t kRookMagics[64] = {
+    0x0080048033244000ULL, 0x0340002001100148ULL, 0x4080082000100080ULL, 0x0080100008008004ULL,
+    0x0200081020020004ULL, 0x0200040200080110ULL, 0x8400500200840801ULL, 0x2a00008044010022ULL,
+    0x0811800040008020ULL, 0x0420402010004001ULL, 0x2665002000421100ULL, 0x0000800800801004ULL,
+    0xa420808008000400ULL, 0x0042001002000408ULL, 0x1600800100800200ULL, 0x100200040204ac41ULL,
+    0x0580004040002000ULL, 0x044001a000281005ULL, 0x0101010018200043ULL, 0x0064220012000840ULL,
+    0x8100808004000800ULL, 0x0042010100080400ULL, 0x01000400b0014208ULL, 0x0002020000804401ULL,
+    0x0440004080008020ULL, 0x0000810100400020ULL, 0x0022002200104084ULL, 0x0028008080081000ULL,
+    0x180c000808008040ULL, 0x0400040080020080ULL, 0x0000212400029008ULL, 0x040b000300014082ULL,
+    0x0040004221800080ULL, 0x0000402000401000ULL, 0x0002200088801000ULL, 0x4980100101000820ULL,
+    0x0000040801001100ULL, 0x1082000802001004ULL, 0x2084080104000210ULL, 0x0010008102001044ULL,
+    0x0056802040008000ULL, 0x0100402010004000ULL, 0x9630410020010011ULL, 0xd000100008008080ULL,
+    0x308800800400800aULL, 0x1004000402008080ULL, 0x02a1021008040001ULL, 0x120010ad00420004ULL,
+    0x10800020014001c0ULL, 0x0c01401001200140ULL, 0x0000402001001100ULL, 0x0080080080100480ULL,
+    0x0000240080080180ULL, 0x309a020004008080ULL, 0xe844800200010080ULL, 0x1100104084110200ULL,
+    0x2033008026004012ULL, 0x10810240023081a1ULL, 0x3001402004110901ULL, 0x5040100104210009ULL,
+    0x008a00100460086aULL, 0x0213000204001825ULL, 0x2421810088021004ULL, 0x0142810400488822ULL,
+};
+
+constexpr uint64_t kBishopMagics[64] = {
+    0xa002080104008200ULL, 0x1090040800802004ULL, 0x5216040102000c08ULL, 0x02041046000c0001ULL,
+    0x000202100080000cULL, 0x0021110840226042ULL, 0xf1433d9672fead70ULL, 0x040a002402480410ULL,
+    0x0b00401404140862ULL, 0x0800041024004283ULL, 0x0040302480810029ULL, 0x0ca2380c811609a0ULL,
+    0x8048020210600000ULL, 0x081482901420a204ULL, 0x0050009a08424041ULL, 0xb3deadf85a73ff77ULL,
+    0x00300a2002100520ULL, 0x8a321de38f6fe8c4ULL, 0x0002002428049100ULL, 0x1408038420212020ULL,
+    0x0002000400a20000ULL, 0x8041000210020120ULL, 0xb8511feb95c83e8aULL, 0x0822020100968400ULL,
+    0x010c403220080583ULL, 0x0014200017220408ULL, 0x1184100082008010ULL, 0x8048080000820002ULL,
+    0xa281004084004050ULL, 0x0588028004406021ULL, 0x4014212004008200ULL, 0x0101050400308810ULL,
+    0x1148210c68101c6bULL, 0x100801048010b400ULL, 0x0244040210010204ULL, 0x2800600800010811ULL,
+    0x04901a0080101004ULL, 0x040090008001008cULL, 0x0008020040028828ULL, 0x0802022608804040ULL,
+    0x0008020884802002ULL, 0x0444040222028900ULL, 0x00002021b0001810ULL, 0x0000004208011082ULL,
+    0x08c002020a000404ULL, 0x1404200081014208ULL, 0x281815210c000208ULL, 0x0081220087002200ULL,
+    0x8001008820481080ULL, 0x5d87f087158cfff5ULL, 0x000000421804010aULL, 0x0000020446080800ULL,
+    0x4400101282020000ULL, 0x0000411082108400ULL, 0x7e3da8302c228266ULL, 0x8f3f63a699a898a7ULL,
+    0x064a941088080800ULL, 0x0c00024414042202ULL, 0x00020cc084009821ULL, 0x38a0002048420204ULL,
+    0x0000800108130401ULL, 0x000040400801010cULL, 0x0001880204480220ULL, 0x0048104102040410ULL,
+};
@@ -0,0 +1,336 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+MovePicker.cpp: Staged move ordering for the search
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+
+#include <MovePicker.h>
+
+MovePicker::MovePicker(Chess& chess, ChessBoard& board, uint16_t hashMove, int ply)  :
+    m_chess(chess),
+    m_board(board),
+    m_hashMove(hashMove),
+    m_ply(ply),
+    m_capturesOnly(false),
+    m_stage(STAGE_HASH_MOVE),
+    m_current(0),
+    m_end(0),
+    m_badEnd(0)
+{
+
+}
+
+MovePicker::MovePicker(Chess& chess, ChessBoard& board)  :
+    m_chess(chess),
+    m_board(board),
+    m_hashMove(0),
+    m_ply(0),
+    m_capturesOnly(true),
+    m_stage(STAGE_GEN_CAPTURES),
+    m_current(0),
+    m_end(0),
+    m_badEnd(0)
+{
+
+}
+
+int MovePicker::mvvLva(int victim, enum SimplePieceTypes attacker, enum MoveType type)
+{
+    int score = (victim >= 0) ? 8 * (victim + 1) - attacker : 0;
+
+    // Queen promotions are as good as winning a queen, underpromotions go last
+    if (type == PROMOTE_TO_QUEEN) score += 8 * (PIECE_QUEEN + 1);
+    else if (ChessBoard::isPromotion(type)) score -= 64;
+
+    return score;
+}
+
+template <enum MoveGenType Gen>
+void MovePicker::generate(int start)
+{
+    bool oppKingDead = false;
+
+    m_current = start;
+    m_end = start;
+
+    m_chess.generateMovesFast<false, Gen>(m_board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
+        (void)b;
+
+        ScoredMove& m = m_moves[m_end++];
+
+        m.from = from;
+        m.to   = to;
+        m.type = type;
+
+        return false;
+    }, oppKingDead);
+
+    bool white = m_board.m_isWhitesTurn;
+
+    const uint16_t* killers = (m_ply < Chess::kMaxPly) ? m_chess.m_killers[m_ply] : nullptr;
+
+    for (int i = start; i < m_end; i++)
+    {
+        ScoredMove& m = m_moves[i];
+
+        m.piece = (enum SimplePieceTypes)m_board.pieceOn(m.from, white);
+
+        if (Gen == GEN_CAPTURES)
+        {
+            int victim = (m.type == EN_PASSENT) ? PIECE_PAWN : m_board.pieceOn(m.to, !white);
+            m.score = mvvLva(victim, m.piece, m.type);
+        }
+        else
+        {
+            uint16_t packed = m.packed();
+
+            if (killers && packed == killers[0])
+                m.score = kKillerScore;
+            else if (killers && packed == killers[1])
+                m.score = kKillerScore - 1;
+            else
+                m.score = m_chess.m_history[white][packed & 63][(packed >> 6) & 63];
+        }
+    }
+}
+
+// The hash move comes from an entry with a matching 64 bit key, so it is almost always legal
+// here, but a key collision can hand us a move from another position. Making an impossible move
+// (a castle without its rook, say) would corrupt the board, so check it as the generator would.
+bool MovePicker::hashMoveIsLegal(ScoredMove& move)
+{
+    bool white = m_board.m_isWhitesTurn;
+
+    move.from  = 1ULL << (m_hashMove & 63);
+    move.to    = 1ULL << ((m_hashMove >> 6) & 63);
+    move.type  = (enum MoveType)(m_hashMove >> 12);
+    move.score = 0;
+
+    int piece  = m_board.pieceOn(move.from, white);
+    int victim = m_board.pieceOn(move.to, !white);
+
+    if (piece < 0 || m_board.pieceOn(move.to, white) >= 0 || victim == PIECE_KING) return false;
+
+    move.piece = (enum SimplePieceTypes)piece;
+
+    int fromSq = Chess::bitScanForward(move.from);
+    int toSq   = Chess::bitScanForward(move.to);
+    int rank   = white ? FIRST_RANK : EIGHTH_RANK;
+    uint64_t occupied = m_board.allWhitePieces() | m_board.allBlackPieces();
+    uint64_t promoteRank = white ? 0xff00'0000'0000'0000ULL : 0x0000'0000'0000'00ffULL;
+
+    // Castling: the king and rook on their squares with the right intact, nothing in between,
+    // and the king not in check or crossing an attacked square
+    if (move.type == CASTLE_KING_SIDE || move.type == CASTLE_QUEEN_SIDE)
+    {
+        bool kingSide = move.type == CASTLE_KING_SIDE;
+        uint64_t rook = COORD_TO_BIT(kingSide ? H_FILE : A_FILE, rank);
+        uint64_t path = kingSide ? COORD_TO_BIT(F_FILE, rank) | COORD_TO_BIT(G_FILE, rank) :
+                                   COORD_TO_BIT(B_FILE, rank) | COORD_TO_BIT(C_FILE, rank) | COORD_TO_BIT(D_FILE, rank);
+        int crossSq = (kingSide ? F_FILE : D_FILE) + rank * 8;
+
+        return piece == PIECE_KING && move.from == COORD_TO_BIT(E_FILE, rank) &&
+               move.to == COORD_TO_BIT(kingSide ? G_FILE : C_FILE, rank) &&
+               !*m_board.myKingHasMoved() && !(kingSide ? *m_board.myHRookHasMoved() : *m_board.myARookHasMoved()) &&
+               (*m_board.myRooks() & rook) && !(occupied & path) &&
+               !m_chess.attackersOf(m_board, fromSq, !white, occupied) &&
+               !m_chess.attackersOf(m_board, crossSq, !white, occupied) &&
+               !m_chess.attackersOf(m_board, toSq, !white, occupied);
+    }
+
+    switch (move.type)
+    {
+        case BASIC_MOVE:
+            if (victim >= 0 || (piece == PIECE_PAWN && (move.to & promoteRank))) return false;
+            break;
+        case CAPTURE:
+            if (victim < 0 || (piece == PIECE_PAWN && (move.to & promoteRank))) return false;
+            break;
+        case EN_PASSENT:
+            if (piece != PIECE_PAWN || m_board.m_can_en_passant_file == INVALID_FILE ||
+                move.to != COORD_TO_BIT(m_board.m_can_en_passant_file, white ? SIXTH_RANK : THIRD_RANK)) return false;
+            break;
+        default:
+            if (piece != PIECE_PAWN || !(move.to & promoteRank)) return false;
+            break;
+    }
+
+    // The piece must be able to reach the target square
+    uint64_t reach;
+
+    switch (piece)
+    {
+        case PIECE_PAWN:
+            if (victim >= 0 || move.type == EN_PASSENT)
+                reach = (white ? m_chess.m_pawnAttacksWhite : m_chess.m_pawnAttacksBlack)[fromSq];
+            else
+                reach = (m_chess.m_arrBetween[fromSq][toSq] & occupied) ? 0 : (white ? m_chess.m_pawnMovesWhite : m_chess.m_pawnMovesBlack)[fromSq];
+            break;
+        case PIECE_KNIGHT:
+        case PIECE_KING:
+            reach = m_chess.m_pieceMoves[piece][fromSq];
+            break;
+        default:
+            reach = m_chess.m_magicbb->pieceAttacks((enum SimplePieceTypes)piece, fromSq, occupied);
+            break;
+    }
+
+    if (!(reach & move.to)) return false;
+
+    // Finally the move mustn't leave our king in check, which takes care of pins
+    UndoRecord undo;
+
+    m_board.makeMove(move.piece, move.from, move.to, move.type, undo);
+    bool legal = !m_chess.attackersOf(m_board, Chess::bitScanForward(*m_board.oppKings()), m_board.m_isWhitesTurn,
+                                      m_board.allWhitePieces() | m_board.allBlackPieces());
+    m_board.unmakeMove(move.piece, move.from, move.to, move.type, undo);
+
+    return legal;
+}
+
+// Selection sort, one move at a time, as we usually only need the first few
+bool MovePicker::pickBest(ScoredMove& move)
+{
+    if (m_current >= m_end) return false;
+
+    int best = m_current;
+
+    for (int i = m_current + 1; i < m_end; i++)
+        if (m_moves[i].score > m_moves[best].score) best = i;
+
+    std::swap(m_moves[m_current], m_moves[best]);
+    move = m_moves[m_current++];
+
+    return true;
+}
+
+// Taking a piece worth at least as much as the capturing piece can't lose material, so only
+// look at the exchange when a more valuable piece captures
+bool MovePicker::losesMaterial(const ScoredMove& move)
+{
+    if (move.type == EN_PASSENT) return false;
+
+    if (move.type == CAPTURE)
+    {
+        int victim = m_board.pieceOn(move.to, !m_board.m_isWhitesTurn);
+
+        if (Chess::kSeeValues[victim] >= Chess::kSeeValues[move.piece]) return false;
+    }
+
+    return m_chess.see(m_board, move.from, move.to, move.type) < 0;
+}
+
+bool MovePicker::next(ScoredMove& move)
+{
+    switch (m_stage)
+    {
+        case STAGE_HASH_MOVE:
+
+            m_stage = STAGE_GEN_CAPTURES;
+
+            if (m_hashMove)
+            {
+                if (hashMoveIsLegal(move)) return true;
+
+                // Never handed out, so the later stages mustn't skip it
+                m_hashMove = 0;
+            }
+
+            [[fallthrough]];
+
+        case STAGE_GEN_CAPTURES:
+
+            generate<GEN_CAPTURES>(0);
+            m_stage = STAGE_CAPTURES;
+
+            [[fallthrough]];
+
+        case STAGE_CAPTURES:
+
+            while (pickBest(move))
+            {
+                if (move.packed() == m_hashMove) continue;
+
+                // Put losing captures aside until after the quiet moves. The quiescence search
+                // doesn't look at them at all.
+                if (losesMaterial(move))
+                {
+                    m_moves[m_badEnd++] = move;
+                    continue;
+                }
+
+                return true;
+            }
+
+            if (m_capturesOnly)
+            {
+                m_stage = STAGE_DONE;
+                return false;
+            }
+
+            m_stage = STAGE_GEN_QUIETS;
+
+            [[fallthrough]];
+
+        case STAGE_GEN_QUIETS:
+
+            generate<GEN_QUIETS>(m_badEnd);
+            m_stage = STAGE_QUIETS;
+
+            [[fallthrough]];
+
+        case STAGE_QUIETS:
+
+            while (pickBest(move))
+                if (move.packed() != m_hashMove) return true;
+
+            m_current = 0;
+            m_end = m_badEnd;
+            m_stage = STAGE_BAD_CAPTURES;
+
+            [[fallthrough]];
+
+        case STAGE_BAD_CAPTURES:
+
+            if (m_current < m_end)
+            {
+                move = m_moves[m_current++];
+                return true;
+            }
+
+            m_stage = STAGE_DONE;
+
+            [[fallthrough]];
+
+        case STAGE_DONE:
+            break;
+    }
+
+    return false;
+}
@@ -0,0 +1,107 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+MovePicker.h: Staged move ordering for the search
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+
+#pragma once
+
+#include <Chess.h>
+
+struct ScoredMove {
+    uint64_t from;
+    uint64_t to;
+    enum MoveType type;
+    enum SimplePieceTypes piece;
+    int score;
+
+    uint16_t packed() const { return Chess::packMove(from, to, type); }
+};
+
+// Hands out the legal moves of a position one at a time, best first:
+// https://www.chessprogramming.org/Move_Ordering
+//
+//  1. The move from the transposition table
+//  2. Captures and promotions, most valuable victim / least valuable attacker first
+//  3. Quiet moves: the two killer moves for this ply, then by history score
+//  4. Captures that lose material according to the static exchange evaluation
+//
+// Each stage is only generated once the previous one is used up, so a cutoff on the hash
+// move or a capture saves generating the quiet moves at all. Killers are scored within the
+// quiet stage rather than tried before it, as they come from other positions and would need
+// a legality check of their own.
+
+class MovePicker {
+
+    public:
+
+        MovePicker(Chess& chess, ChessBoard& board, uint16_t hashMove, int ply);
+
+        // Captures and promotions that don't lose material, for the quiescence search
+        MovePicker(Chess& chess, ChessBoard& board);
+
+        bool next(ScoredMove& move);
+
+        // Ordering value of a capture or promotion
+        static int mvvLva(int victim, enum SimplePieceTypes attacker, enum MoveType type);
+
+    private:
+
+        enum Stage {
+            STAGE_HASH_MOVE,
+            STAGE_GEN_CAPTURES,
+            STAGE_CAPTURES,
+            STAGE_GEN_QUIETS,
+            STAGE_QUIETS,
+            STAGE_BAD_CAPTURES,
+            STAGE_DONE
+        };
+
+        static constexpr int kMaxMoves = 256;
+        static constexpr int kKillerScore = 1 << 30;
+
+        template <enum MoveGenType Gen>
+        void generate(int start);
+
+        bool hashMoveIsLegal(ScoredMove& move);
+        bool pickBest(ScoredMove& move);
+        bool losesMaterial(const ScoredMove& move);
+
+        Chess&      m_chess;
+        ChessBoard& m_board;
+        uint16_t    m_hashMove;
+        int         m_ply;
+        bool        m_capturesOnly;
+        enum Stage  m_stage;
+
+        ScoredMove  m_moves[kMaxMoves];
+        int         m_current;
+        int         m_end;
+        int         m_badEnd;       // Losing captures are kept at the front of m_moves
+};
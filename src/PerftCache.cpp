@@ -0,0 +1,90 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+PerftCache.cpp: Hash table of perft subtree node counts
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+
+#include <PerftCache.h>
+
+PerftCache::PerftCache(std::size_t megabytes)
+{
+    resize(megabytes);
+}
+
+bool PerftCache::probe(uint64_t key, int depth, uint64_t& nodes) const
+{
+    const PerftBucket& bucket = m_buckets.bucket(key);
+
+    for (int i = 0; i < PerftBucket::kEntries; i++)
+    {
+        uint64_t data       = bucket.slots[i].data.load(std::memory_order_relaxed);
+        uint64_t keyXorData = bucket.slots[i].keyXorData.load(std::memory_order_relaxed);
+
+        if (data != 0 && (keyXorData ^ data) == key && (int)(data >> kDepthShift) == depth)
+        {
+            nodes = data & kNodesMask;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PerftCache::store(uint64_t key, int depth, uint64_t nodes)
+{
+    PerftBucket& bucket = m_buckets.bucket(key);
+    PerftSlot* replace = &bucket.slots[0];
+    int replaceDepth = 1 << 30;
+
+    for (int i = 0; i < PerftBucket::kEntries; i++)
+    {
+        PerftSlot* slot = &bucket.slots[i];
+        uint64_t data = slot->data.load(std::memory_order_relaxed);
+
+        if (data == 0)
+        {
+            replace = slot;
+            break;
+        }
+
+        // Deeper subtrees are more expensive to recount, so replace the shallowest entry
+        int d = (int)(data >> kDepthShift);
+
+        if (d < replaceDepth)
+        {
+            replaceDepth = d;
+            replace = slot;
+        }
+    }
+
+    uint64_t data = ((uint64_t)depth << kDepthShift) | (nodes & kNodesMask);
+
+    replace->data.store(data, std::memory_order_relaxed);
+    replace->keyXorData.store(key ^ data, std::memory_order_relaxed);
+}
@@ -0,0 +1,79 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+PerftCache.h: Hash table of perft subtree node counts
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <BucketTable.h>
+
+// Perft hash table: https://www.chessprogramming.org/Perft#Hashing
+//
+// Stores the node count of each subtree keyed by position hash and depth, so transposed
+// subtrees are only counted once. Entries use the same lockless key XOR data scheme as the
+// transposition table so the cache can be shared by parallel perft threads.
+
+struct PerftSlot {
+    std::atomic<uint64_t> keyXorData;
+    std::atomic<uint64_t> data;     // Node count in the low 56 bits, depth in the top 8
+};
+
+struct alignas(64) PerftBucket {
+    static constexpr int kEntries = 4;
+    PerftSlot slots[kEntries];
+};
+
+class PerftCache {
+
+    public:
+
+        static constexpr std::size_t kDefaultSizeMB = 64;
+
+        PerftCache(std::size_t megabytes = kDefaultSizeMB);
+
+        void resize(std::size_t megabytes) { m_buckets.resize(megabytes); }
+        void clear() { m_buckets.clear(); }
+
+        bool probe(uint64_t key, int depth, uint64_t& nodes) const;
+        void store(uint64_t key, int depth, uint64_t nodes);
+
+        std::size_t sizeInBytes() const { return m_buckets.sizeInBytes(); }
+
+    private:
+
+        static constexpr int      kDepthShift = 56;
+        static constexpr uint64_t kNodesMask  = (1ULL << kDepthShift) - 1;
+
+        BucketTable<PerftBucket> m_buckets;
+};
@@ -0,0 +1,110 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+TranspositionTable.cpp: Hash table of previously searched positions
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <TranspositionTable.h>
+#include <bit>
+
+TranspositionTable::TranspositionTable(std::size_t megabytes)  :
+    m_age(0)
+{
+    resize(megabytes);
+}
+
+bool TranspositionTable::probe(uint64_t key, TTEntry& entry) const
+{
+    const TTBucket& bucket = m_buckets.bucket(key);
+
+    for (int i = 0; i < TTBucket::kEntries; i++)
+    {
+        uint64_t data       = bucket.slots[i].data.load(std::memory_order_relaxed);
+        uint64_t keyXorData = bucket.slots[i].keyXorData.load(std::memory_order_relaxed);
+
+        if (data != 0 && (keyXorData ^ data) == key)
+        {
+            static_cast<TTData&>(entry) = std::bit_cast<TTData>(data);
+            entry.key = key;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TranspositionTable::store(uint64_t key, int depth, enum TTBound bound, double score, uint16_t move)
+{
+    TTBucket& bucket = m_buckets.bucket(key);
+    TTSlot* replace = &bucket.slots[0];
+    int replaceScore = 1 << 30;
+
+    for (int i = 0; i < TTBucket::kEntries; i++)
+    {
+        TTSlot* slot = &bucket.slots[i];
+        uint64_t data = slot->data.load(std::memory_order_relaxed);
+        TTData e = std::bit_cast<TTData>(data);
+
+        if (data == 0)
+        {
+            replace = slot;
+            break;
+        }
+
+        if ((slot->keyXorData.load(std::memory_order_relaxed) ^ data) == key)
+        {
+            // Keep the old best move if we don't have a new one
+            if (move == 0) move = e.move;
+            replace = slot;
+            break;
+        }
+
+        // Prefer to replace shallow entries, and entries left over from earlier searches
+        int age   = (m_age - e.age) & 63;
+        int value = e.depth - 4 * age;
+
+        if (value < replaceScore)
+        {
+            replaceScore = value;
+            replace = slot;
+        }
+    }
+
+    TTData e;
+
+    e.score  = (float)score;
+    e.move   = move;
+    e.depth  = (int8_t)depth;
+    e.bound  = bound;
+    e.age    = m_age;
+
+    uint64_t data = std::bit_cast<uint64_t>(e);
+
+    replace->data.store(data, std::memory_order_relaxed);
+    replace->keyXorData.store(key ^ data, std::memory_order_relaxed);
+}
@@ -0,0 +1,106 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+TranspositionTable.h: Hash table of previously searched positions
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <BucketTable.h>
+
+// Transposition table: https://www.chessprogramming.org/Transposition_Table
+//
+// The table is split into cache line sized buckets of four entries. A position hashes
+// to a single bucket, and within the bucket the shallowest / oldest entry is replaced.
+//
+// The table is shared between search threads without locking. Each entry is stored as two
+// 64 bit words, the key XORed with the data and the data itself, so that an entry torn by
+// two threads writing at once fails the key check on probe:
+// https://www.chessprogramming.org/Shared_Hash_Table#Lockless
+
+enum TTBound {
+    TT_BOUND_NONE  = 0,   // Empty entry
+    TT_BOUND_EXACT = 1,   // Score is exact
+    TT_BOUND_LOWER = 2,   // Score is a lower bound (search failed high)
+    TT_BOUND_UPPER = 3    // Score is an upper bound (search failed low)
+};
+
+// Entry data, packed into a single 64 bit word
+struct TTData {
+    float    score;     // From the point of view of the side to move
+    uint16_t move;      // Packed best move, 0 if none
+    int8_t   depth;
+    uint8_t  bound : 2;
+    uint8_t  age   : 6;
+};
+
+static_assert(sizeof(TTData) == sizeof(uint64_t), "TTData must pack into 64 bits");
+
+struct TTEntry : TTData {
+    uint64_t key;
+};
+
+struct TTSlot {
+    std::atomic<uint64_t> keyXorData;
+    std::atomic<uint64_t> data;
+};
+
+struct alignas(64) TTBucket {
+    static constexpr int kEntries = 4;
+    TTSlot slots[kEntries];
+};
+
+class TranspositionTable {
+
+    public:
+
+        static constexpr std::size_t kDefaultSizeMB = 16;
+
+        TranspositionTable(std::size_t megabytes = kDefaultSizeMB);
+
+        void resize(std::size_t megabytes) { m_buckets.resize(megabytes); }
+        void clear() { m_buckets.clear(); }
+
+        // Called at the start of each search so that entries from previous searches
+        // are preferred for replacement. Must not be called while threads are searching.
+        void newSearch() { m_age = (m_age + 1) & 63; }
+
+        bool probe(uint64_t key, TTEntry& entry) const;
+        void store(uint64_t key, int depth, enum TTBound bound, double score, uint16_t move);
+
+        std::size_t sizeInBytes() const { return m_buckets.sizeInBytes(); }
+
+    private:
+
+        BucketTable<TTBucket> m_buckets;
+        std::uint8_t m_age;
+};
@@ -0,0 +1,97 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+    ChessEngine : A chess engine written in C++ for SDL2
+
+Zobrist.h: Zobrist hashing keys for chess positions
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+// Zobrist hashing: https://www.chessprogramming.org/Zobrist_Hashing
+//
+// Piece keys are indexed by the bit number of the PieceTypes enum (WHITE_PAWN = 0 ...
+// BLACK_QUEEN = 11), so that index = __builtin_ctz(pieceType).
+
+enum ZobristCastleFlags {
+    ZOBRIST_WHITE_KING_MOVED    = 0,
+    ZOBRIST_BLACK_KING_MOVED    = 1,
+    ZOBRIST_WHITE_A_ROOK_MOVED  = 2,
+    ZOBRIST_WHITE_H_ROOK_MOVED  = 3,
+    ZOBRIST_BLACK_A_ROOK_MOVED  = 4,
+    ZOBRIST_BLACK_H_ROOK_MOVED  = 5
+};
+
+struct ZobristKeys {
+
+    uint64_t pieces[12][64];
+    uint64_t blackToMove;
+    uint64_t castling[6];
+    uint64_t enPassantFile[8];
+
+    // SplitMix64 - we want the same keys every run, so that hashes can be compared
+    // between runs and builds.
+    static constexpr uint64_t splitMix64(uint64_t& state)
+    {
+        uint64_t z = (state += 0x9e37'79b9'7f4a'7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58'476d'1ce4'e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d0'49bb'1331'11ebULL;
+        return z ^ (z >> 31);
+    }
+
+    static constexpr ZobristKeys generate()
+    {
+        ZobristKeys keys {};
+        uint64_t state = 0x0c4e'55e7'0b51'd0a1ULL;
+
+        for (int piece = 0; piece < 12; piece++)
+            for (int sq = 0; sq < 64; sq++)
+                keys.pieces[piece][sq] = splitMix64(state);
+
+        keys.blackToMove = splitMix64(state);
+
+        for (int i = 0; i < 6; i++)
+            keys.castling[i] = splitMix64(state);
+
+        for (int i = 0; i < 8; i++)
+            keys.enPassantFile[i] = splitMix64(state);
+
+        return keys;
+    }
+};
+
+inline constexpr ZobristKeys g_zobrist = ZobristKeys::generate();
+
+// Build with -DDEBUG_ZOBRIST (e.g. make DEFINES=-DDEBUG_ZOBRIST test) to cross check the
+// incrementally updated hash of a board against a hash computed from scratch.
+#ifdef DEBUG_ZOBRIST
+    #define CHECK_ZOBRIST(board) assert((board).hash() == (board).computeHash())
+#else
+    #define CHECK_ZOBRIST(board)
+#endif
@@ -29,6 +29,8 @@ SOFTWARE.
 
 */
 
+#include "perftResults.h"
+
 #include <BetaChess.h>
 
 class BetaChessTest : public ::testing::Test {
@@ -42,10 +44,10 @@ class BetaChessTest : public ::testing::Test {
             delete m_chess;
         }
 
-        uint64_t RunPerft(int depth) {
+        uint64_t RunPerft(int depth, bool bulk = false) {
 
             std::chrono::time_point<std::chrono::high_resolution_clock> oldTime = std::chrono::high_resolution_clock::now();        
-                uint64_t nodes = m_chess->perft(depth); 
+                uint64_t nodes = m_chess->perft(depth, bulk); 
                 printf("Perft %d: Nodes: %ld\n", depth, nodes);
             auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - oldTime);
             double kNPS = (double)nodes / (usecs.count() / 1'000'000.0) / 1'000.0;    
@@ -65,11 +67,101 @@ TEST_F(BetaChessTest, TestMoveGen)
 
     printf("n moves: %d\n", n_moves);
 
+    ASSERT_EQ(n_moves, 20);
 }
 
 TEST_F(BetaChessTest, TestPerft)
 {
-    RunPerft(8);
+    ASSERT_EQ(RunPerft(1), 20);
+    ASSERT_EQ(RunPerft(2), 400);
+    ASSERT_EQ(RunPerft(3), 8902);
+    ASSERT_EQ(RunPerft(4), 197281);
+    ASSERT_EQ(RunPerft(5), 4'865'609);
+    ASSERT_EQ(RunPerft(6), 119'060'324);
+}
+
+TEST_F(BetaChessTest, TestPerftBulk)
+{
+    for (int depth = 1; depth <= 6; depth++)
+        ASSERT_EQ(RunPerft(depth, true), kStartPositionPerft[depth]);
+
+    ASSERT_TRUE(m_chess->setBoardFromFEN(kKiwipeteFEN));
+
+    ASSERT_EQ(RunPerft(4, true), kKiwipetePerft4);
+}
+
+TEST_F(BetaChessTest, TestPerftDivide)
+{
+    std::vector<std::pair<std::string, uint64_t>> divide;
+
+    ASSERT_EQ(m_chess->perftDivide(3, divide), kStartPositionPerft[3]);
+    ASSERT_EQ(divide.size(), kStartPositionPerft[1]);
+
+    for (auto& [move, count] : kStartPositionDivide3)
+        ASSERT_TRUE(std::find(divide.begin(), divide.end(), std::make_pair(std::string(move), count)) != divide.end()) << move;
+
+    // Promotions are listed separately with their piece
+    ASSERT_TRUE(m_chess->setBoardFromFEN("8/P7/8/8/8/8/8/k6K w - - 0 1"));
+    ASSERT_EQ(m_chess->perftDivide(1, divide), 7);
+    ASSERT_EQ(std::count_if(divide.begin(), divide.end(), [] (auto& d) { return d.first.substr(0, 4) == "a7a8"; }), 4);
+    ASSERT_TRUE(std::any_of(divide.begin(), divide.end(), [] (auto& d) { return d.first == "a7a8n"; }));
+}
+
+// https://www.chessprogramming.org/Perft_Results
+TEST_F(BetaChessTest, TestPerftKiwipete)
+{
+    ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+
+    ASSERT_EQ(RunPerft(1), 48);
+    ASSERT_EQ(RunPerft(2), 2039);
+    ASSERT_EQ(RunPerft(3), 97862);
+    ASSERT_EQ(RunPerft(4), 4'085'603);
+    ASSERT_EQ(RunPerft(5), 193'690'690);
+    // Too slow...
+    // ASSERT_EQ(RunPerft(6), 8'031'647'685);
 }
 
+TEST_F(BetaChessTest, TestPerftPosition3)
+{
+    // En passant, including en passant captures which expose the king along the rank
+    ASSERT_TRUE(m_chess->setBoardFromFEN("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1"));
+
+    ASSERT_EQ(RunPerft(1), 14);
+    ASSERT_EQ(RunPerft(2), 191);
+    ASSERT_EQ(RunPerft(3), 2812);
+    ASSERT_EQ(RunPerft(4), 43238);
+    ASSERT_EQ(RunPerft(5), 674'624);
+    ASSERT_EQ(RunPerft(6), 11'030'083);
+}
+
+TEST_F(BetaChessTest, TestPerftPosition4)
+{
+    // Promotions and castling rights lost to captured rooks
+    ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"));
+
+    ASSERT_EQ(RunPerft(1), 6);
+    ASSERT_EQ(RunPerft(2), 264);
+    ASSERT_EQ(RunPerft(3), 9467);
+    ASSERT_EQ(RunPerft(4), 422'333);
+    ASSERT_EQ(RunPerft(5), 15'833'292);
+}
 
+TEST_F(BetaChessTest, TestConstructionTime)
+{
+    // Start-up cost of an engine instance. The attack tables are built once per process and
+    // shared, so this should be cheap after the first.
+    constexpr int kInstances = 20;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < kInstances; i++)
+    {
+        BetaChess chess;
+
+        ASSERT_EQ(&chess.blockers(), &m_chess->blockers());
+        ASSERT_EQ(chess.magics(), m_chess->magics());
+    }
+
+    auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    printf("BetaChess construction: %1.2f ms\n", usecs.count() / 1'000.0 / kInstances);
+}
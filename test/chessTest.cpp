@@ -31,7 +31,12 @@ SOFTWARE.
 
 #include <gtest/gtest.h>
 
+#include "perftResults.h"
+
 #include <Chess.h>
+#include <MovePicker.h>
+#include <thread>
+#include <random>
 
 class ChessTest : public ::testing::Test {
     protected:
@@ -44,10 +49,10 @@ class ChessTest : public ::testing::Test {
             delete m_chess;
         }
 
-        uint64_t RunPerft(int depth) {
+        uint64_t RunPerft(int depth, bool bulk = false) {
 
             std::chrono::time_point<std::chrono::high_resolution_clock> oldTime = std::chrono::high_resolution_clock::now();        
-                uint64_t nodes = m_chess->perft(depth); 
+                uint64_t nodes = m_chess->perft(depth, bulk); 
                 printf("Perft %d: Nodes: %ld\n", depth, nodes);
             auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - oldTime);
             double kNPS = (double)nodes / (usecs.count() / 1'000'000.0) / 1'000.0;    
@@ -68,6 +73,37 @@ class ChessTest : public ::testing::Test {
             return nodes;
         }
 
+        // Middlegame positions for measuring the pruning, each searched separately
+        static inline const std::vector<const char*> kSearchPositions = {
+            "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+            "r1bq1rk1/pp2bppp/2n1pn2/2pp4/3P4/2PBPN2/PP1N1PPP/R1BQ1RK1 w - - 0 8",
+            "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+        };
+
+        // Search each position to a fixed depth from an empty table, returning the total nodes
+        uint64_t RunSearch(const std::vector<const char*>& positions, int depth) {
+
+            SearchLimits limits;
+            limits.moveTimeMs = 600'000;
+            limits.maxDepth = depth;
+            m_chess->setSearchLimits(limits);
+
+            uint64_t nodes = 0;
+
+            for (const char* fen : positions)
+            {
+                EXPECT_TRUE(m_chess->setBoardFromFEN(fen));
+                m_chess->m_tt->clear();
+
+                int x1, y1, x2, y2;
+                PromotionType promote;
+
+                m_chess->getBestMove(x1, y1, x2, y2, promote);
+                nodes += m_chess->m_searchNodes;
+            }
+
+            return nodes;
+        }
 
         Chess *m_chess;
 };
@@ -148,6 +184,134 @@ TEST_F(ChessTest, perft)
     //ASSERT_EQ(RunPerft(7), 3'195'901'860 );
 }
 
+TEST_F(ChessTest, perftBulk)
+{
+    for (int depth = 1; depth <= 6; depth++)
+        ASSERT_EQ(RunPerft(depth, true), kStartPositionPerft[depth]);
+
+    ASSERT_TRUE(m_chess->setBoardFromFEN(kKiwipeteFEN));
+
+    ASSERT_EQ(RunPerft(4, true), kKiwipetePerft4);
+}
+
+TEST_F(ChessTest, perftParallel)
+{
+    for (int threads : {1, 2, 4, 8})
+    {
+        ASSERT_EQ(m_chess->perftParallel(1, threads), 20);
+        ASSERT_EQ(m_chess->perftParallel(5, threads), 4'865'609);
+        ASSERT_EQ(m_chess->perftParallel(6, threads), 119'060'324);
+    }
+
+    //ASSERT_EQ(m_chess->perftParallel(7, std::thread::hardware_concurrency()), 3'195'901'860);
+    //ASSERT_EQ(m_chess->perftParallel(8, std::thread::hardware_concurrency()), 84'998'978'956);
+
+    ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+
+    ASSERT_EQ(m_chess->perftParallel(5, 4), 193'690'690);
+}
+
+TEST_F(ChessTest, perftHashed)
+{
+    for (bool bulk : {false, true})
+    {
+        // Fresh table for each pass so the second doesn't just read back the first
+        m_chess->setPerftHashSize(64);
+
+        ASSERT_TRUE(m_chess->setBoardFromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"));
+        ASSERT_EQ(RunPerft(5, bulk), 4'865'609);
+        ASSERT_EQ(RunPerft(6, bulk), 119'060'324);
+        //ASSERT_EQ(RunPerft(7, bulk), 3'195'901'860);
+
+        ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+        ASSERT_EQ(RunPerft(5, bulk), 193'690'690);
+
+        ASSERT_TRUE(m_chess->setBoardFromFEN("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1"));
+        ASSERT_EQ(RunPerft(6, bulk), 11'030'083);
+
+        ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"));
+        ASSERT_EQ(RunPerft(5, bulk), 15'833'292);
+    }
+
+    ASSERT_TRUE(m_chess->setBoardFromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"));
+    ASSERT_EQ(m_chess->perftParallel(6, 4), 119'060'324);
+}
+
+TEST_F(ChessTest, perftDivide)
+{
+    std::vector<std::pair<std::string, uint64_t>> divide;
+
+    ASSERT_EQ(m_chess->perftDivide(3, divide), kStartPositionPerft[3]);
+    ASSERT_EQ(divide.size(), kStartPositionPerft[1]);
+
+    for (auto& [move, count] : kStartPositionDivide3)
+        ASSERT_TRUE(std::find(divide.begin(), divide.end(), std::make_pair(std::string(move), count)) != divide.end()) << move;
+
+    // Promotions are listed separately with their piece
+    ASSERT_TRUE(m_chess->setBoardFromFEN("8/P7/8/8/8/8/8/k6K w - - 0 1"));
+    ASSERT_EQ(m_chess->perftDivide(1, divide), 7);
+    ASSERT_EQ(std::count_if(divide.begin(), divide.end(), [] (auto& d) { return d.first.substr(0, 4) == "a7a8"; }), 4);
+    ASSERT_TRUE(std::any_of(divide.begin(), divide.end(), [] (auto& d) { return d.first == "a7a8n"; }));
+}
+
+TEST_F(ChessTest, generateWithoutMaking)
+{
+    // Without MakeMoves the callback sees the board as it was, even for en passant, which is
+    // made and taken back to test it for check
+    ASSERT_TRUE(m_chess->setBoardFromFEN("rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3"));
+
+    uint64_t hash = m_chess->m_board.hash();
+    int enPassants = 0;
+    bool oppKingDead = false;
+
+    m_chess->generateMovesFast<false>(m_chess->m_board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
+        (void)from;
+        (void)to;
+        EXPECT_EQ(b.hash(), hash);
+        if (type == EN_PASSENT) enPassants++;
+        return false;
+    }, oppKingDead);
+
+    ASSERT_EQ(enPassants, 1);
+}
+
+// https://www.chessprogramming.org/Perft_Results
+TEST_F(ChessTest, perftKiwipete)
+{
+    ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+
+    ASSERT_EQ(RunPerft(1), 48);
+    ASSERT_EQ(RunPerft(2), 2039);
+    ASSERT_EQ(RunPerft(3), 97862);
+    ASSERT_EQ(RunPerft(4), 4'085'603);
+    ASSERT_EQ(RunPerft(5), 193'690'690);
+}
+
+TEST_F(ChessTest, perftPosition3)
+{
+    // En passant captures which would expose the king along the rank
+    ASSERT_TRUE(m_chess->setBoardFromFEN("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1"));
+
+    ASSERT_EQ(RunPerft(1), 14);
+    ASSERT_EQ(RunPerft(2), 191);
+    ASSERT_EQ(RunPerft(3), 2812);
+    ASSERT_EQ(RunPerft(4), 43238);
+    ASSERT_EQ(RunPerft(5), 674'624);
+    ASSERT_EQ(RunPerft(6), 11'030'083);
+}
+
+TEST_F(ChessTest, perftPosition4)
+{
+    // Promotions, including by capture, and castling rights lost to captured rooks
+    ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"));
+
+    ASSERT_EQ(RunPerft(1), 6);
+    ASSERT_EQ(RunPerft(2), 264);
+    ASSERT_EQ(RunPerft(3), 9467);
+    ASSERT_EQ(RunPerft(4), 422'333);
+    ASSERT_EQ(RunPerft(5), 15'833'292);
+}
+
 TEST_F(ChessTest, perftSlow)
 {
     ASSERT_EQ(RunPerftSlow(1), 20);
@@ -158,3 +322,827 @@ TEST_F(ChessTest, perftSlow)
    // ASSERT_EQ(RunPerftSlow(5), 4'865'609);
    // ASSERT_EQ(RunPerftSlow(6), 119'060'324);
 }
+
+TEST_F(ChessTest, zobristTransposition)
+{
+    uint64_t startHash = m_chess->m_board.computeHash();
+
+    bool ep, castle_kings_side, castle_queens_side;
+
+    // Knights out and back again should transpose to the start position
+    m_chess->makeMove(G_FILE, FIRST_RANK, F_FILE, THIRD_RANK, ep, castle_kings_side, castle_queens_side);
+    ASSERT_NE(m_chess->m_board.computeHash(), startHash);
+    m_chess->makeMove(G_FILE, EIGHTH_RANK, F_FILE, SIXTH_RANK, ep, castle_kings_side, castle_queens_side);
+    m_chess->makeMove(F_FILE, THIRD_RANK, G_FILE, FIRST_RANK, ep, castle_kings_side, castle_queens_side);
+    m_chess->makeMove(F_FILE, SIXTH_RANK, G_FILE, EIGHTH_RANK, ep, castle_kings_side, castle_queens_side);
+    ASSERT_EQ(m_chess->m_board.computeHash(), startHash);
+
+    // A double pawn push sets the en passant file, which must change the hash
+    ChessBoard b = m_chess->m_board;
+    m_chess->makeMoveForBoard(b, E_FILE, SECOND_RANK, E_FILE, FOURTH_RANK, ep, castle_kings_side, castle_queens_side, false);
+    uint64_t h1 = b.computeHash();
+    b.m_can_en_passant_file = INVALID_FILE;
+    ASSERT_NE(b.computeHash(), h1);
+}
+
+TEST_F(ChessTest, transpositionTableNodeCount)
+{
+    ChessMove m1, m2;
+    uint64_t nposNoTT = 0, nposTT = 0;
+
+    m_chess->m_useTranspositionTable = false;
+    m_chess->minimaxAlphaBetaFaster(m_chess->m_board, true, m1, true, 5, nposNoTT, -1e10, 1e10);
+
+    m_chess->m_useTranspositionTable = true;
+    m_chess->m_tt->clear();
+    m_chess->minimaxAlphaBetaFaster(m_chess->m_board, true, m2, true, 5, nposTT, -1e10, 1e10);
+
+    printf("Depth 5 nodes: without TT %ld, with TT %ld\n", nposNoTT, nposTT);
+
+    ASSERT_LT(nposTT, nposNoTT);
+}
+
+TEST_F(ChessTest, incrementalZobrist)
+{
+    // Every child generated by the fast move generator must carry the same hash as
+    // one computed from scratch
+    uint64_t nchecked = 0;
+
+    std::function<void (ChessBoard&, int)> walk = [&] (ChessBoard& board, int depth) {
+        bool oppKingDead = false;
+        m_chess->generateMovesFast(board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
+            (void)from;
+            (void)to;
+            (void)type;
+            EXPECT_EQ(b.hash(), b.computeHash());
+            nchecked++;
+            if (depth > 1) walk(b, depth - 1);
+            return false;
+        }, oppKingDead);
+    };
+
+    walk(m_chess->m_board, 4);
+
+    printf("Checked %ld positions\n", nchecked);
+}
+
+TEST_F(ChessTest, makeUnmake)
+{
+    // Generating moves makes and takes back each move in place, so the board must come
+    // back exactly as it was, including through castling, en passant and promotion
+    const char* positions[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+        "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1",
+    };
+
+    std::function<void (ChessBoard&, int)> walk = [&] (ChessBoard& board, int depth) {
+        ChessBoard before(board);
+        bool oppKingDead = false;
+
+        m_chess->generateMovesFast(board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
+            (void)from;
+            (void)to;
+            (void)type;
+            EXPECT_EQ(b.hash(), b.computeHash());
+            if (depth > 1) walk(b, depth - 1);
+            return false;
+        }, oppKingDead);
+
+        for (int i = 0; i < 2; i++)
+        {
+            EXPECT_EQ(*board.pawns[i],   *before.pawns[i]);
+            EXPECT_EQ(*board.knights[i], *before.knights[i]);
+            EXPECT_EQ(*board.bishops[i], *before.bishops[i]);
+            EXPECT_EQ(*board.rooks[i],   *before.rooks[i]);
+            EXPECT_EQ(*board.queens[i],  *before.queens[i]);
+            EXPECT_EQ(*board.kings[i],   *before.kings[i]);
+        }
+
+        EXPECT_EQ(board.m_isWhitesTurn, before.m_isWhitesTurn);
+        EXPECT_EQ(board.m_can_en_passant_file, before.m_can_en_passant_file);
+        EXPECT_EQ(board.castleFlags(), before.castleFlags());
+        EXPECT_EQ(board.hash(), before.hash());
+    };
+
+    for (const char* fen : positions)
+    {
+        ASSERT_TRUE(m_chess->setBoardFromFEN(fen));
+        walk(m_chess->m_board, 3);
+    }
+}
+
+TEST_F(ChessTest, iterativeDeepeningMoveTime)
+{
+    SearchLimits limits;
+    limits.moveTimeMs = 500;
+    m_chess->setSearchLimits(limits);
+
+    int x1, y1, x2, y2;
+    enum PromotionType promote;
+
+    auto start = std::chrono::steady_clock::now();
+    m_chess->getBestMove(x1, y1, x2, y2, promote);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    printf("Searched to depth %d in %ld ms\n", m_chess->m_completedDepth, ms);
+
+    ASSERT_GE(m_chess->m_completedDepth, 1);
+    ASSERT_LT(ms, 1000);
+    ASSERT_NE(x1, INVALID_FILE);
+}
+
+TEST_F(ChessTest, iterativeDeepeningFixedDepth)
+{
+    SearchLimits limits;
+    limits.moveTimeMs = 60'000;
+    limits.maxDepth = 4;
+    m_chess->setSearchLimits(limits);
+
+    int x1, y1, x2, y2;
+    enum PromotionType promote;
+
+    m_chess->getBestMove(x1, y1, x2, y2, promote);
+
+    ASSERT_EQ(m_chess->m_completedDepth, 4);
+}
+
+TEST_F(ChessTest, setBoardFromFEN)
+{
+    uint64_t startHash = m_chess->m_board.hash();
+
+    ASSERT_TRUE(m_chess->setBoardFromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"));
+    ASSERT_EQ(m_chess->m_board.hash(), startHash);
+    ASSERT_EQ(RunPerft(3), 8902);
+
+    ASSERT_FALSE(m_chess->setBoardFromFEN("not a fen"));
+    ASSERT_EQ(m_chess->m_board.hash(), startHash);
+}
+
+TEST_F(ChessTest, lazySMPScaling)
+{
+    // Time to depth and NPS for a fixed set of positions as the number of threads grows.
+    // The speedup depends on the number of cores on the machine running the test.
+    const char* positions[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r1bq1rk1/pp2bppp/2n1pn2/2pp4/3P4/2PBPN2/PP1N1PPP/R1BQ1RK1 w - - 0 8",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    };
+
+    SearchLimits limits;
+    limits.moveTimeMs = 600'000;
+    limits.maxDepth = 5;
+    m_chess->setSearchLimits(limits);
+
+    double baseTime = 0.0;
+
+    for (int threads : { 1, 2, 4, 8, 16 })
+    {
+        m_chess->setSearchThreads(threads);
+
+        double totalTime = 0.0;
+        uint64_t totalNodes = 0;
+
+        for (const char* fen : positions)
+        {
+            ASSERT_TRUE(m_chess->setBoardFromFEN(fen));
+            m_chess->m_tt->clear();
+
+            int x1, y1, x2, y2;
+            enum PromotionType promote;
+
+            auto start = std::chrono::steady_clock::now();
+            m_chess->getBestMove(x1, y1, x2, y2, promote);
+            totalTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1'000'000.0;
+            totalNodes += m_chess->m_searchNodes;
+
+            ASSERT_EQ(m_chess->m_completedDepth, 5);
+            ASSERT_NE(x1, INVALID_FILE);
+        }
+
+        if (threads == 1) baseTime = totalTime;
+
+        printf("Threads %2d: time to depth %d %1.3f secs (speedup %1.2f) %1.1f KNps\n", threads, limits.maxDepth, 
+                totalTime, baseTime / totalTime, totalNodes / 1000.0 / totalTime);
+    }
+}
+
+TEST_F(ChessTest, constructionTime)
+{
+    // Start-up cost of an engine instance. The attack tables are built once per process and
+    // shared, so this should be cheap after the first.
+    constexpr int kInstances = 20;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < kInstances; i++)
+    {
+        Chess chess;
+
+        ASSERT_EQ(chess.m_pieceMoves, m_chess->m_pieceMoves);
+        ASSERT_EQ(chess.m_magicbb, m_chess->m_magicbb);
+    }
+
+    auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    printf("Chess construction: %1.2f ms\n", usecs.count() / 1'000.0 / kInstances);
+}
+
+TEST_F(ChessTest, slidingAttackBackends)
+{
+    // Compare the magic and PEXT (if built with -DUSE_PEXT and supported) backends on random occupancies
+    Blockers blockers;
+    blockers.computeBlockersAndBeyond();
+
+    auto magic = std::make_unique<MagicBitboards>();
+    auto pext  = std::make_unique<MagicBitboards>();
+
+    magic->computeTables(&blockers, false);
+    pext->computeTables(&blockers, true);
+
+    constexpr int kSamples = 1 << 16;
+    constexpr int kRounds  = 64;
+
+    std::mt19937_64 rng(1234);
+    std::vector<uint64_t> occupancies(kSamples);
+
+    for (auto& occ : occupancies)
+        occ = rng() & rng();
+
+    for (int i = 0; i < kSamples; i++)
+    {
+        int sq = i & 63;
+        ASSERT_EQ(magic->rookAttacks(sq, occupancies[i]), pext->rookAttacks(sq, occupancies[i]));
+        ASSERT_EQ(magic->bishopAttacks(sq, occupancies[i]), pext->bishopAttacks(sq, occupancies[i]));
+    }
+
+    for (auto* mbb : {magic.get(), pext.get()})
+    {
+        uint64_t sum = 0;
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        for (int r = 0; r < kRounds; r++)
+            for (int i = 0; i < kSamples; i++)
+                sum += mbb->pieceAttacks(PIECE_QUEEN, (i + r) & 63, occupancies[i]);
+
+        auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+        printf("%s: %1.2f ns per queen lookup (%lx)\n", mbb->usingPext() ? "PEXT" : "Magic",
+                usecs.count() * 1'000.0 / kSamples / kRounds, sum);
+    }
+}
+
+static uint64_t pickerPerft(Chess& chess, ChessBoard& board, int depth)
+{
+    MovePicker picker(chess, board, 0, 0);
+    ScoredMove sm;
+    uint64_t nodes = 0;
+
+    while (picker.next(sm))
+    {
+        if (depth == 1)
+        {
+            nodes++;
+            continue;
+        }
+
+        UndoRecord undo;
+        board.makeMove(sm.piece, sm.from, sm.to, sm.type, undo);
+        nodes += pickerPerft(chess, board, depth - 1);
+        board.unmakeMove(sm.piece, sm.from, sm.to, sm.type, undo);
+    }
+
+    return nodes;
+}
+
+TEST_F(ChessTest, movePickerStages)
+{
+    // Captures and quiets generated in separate stages must add up to the full move list
+    ASSERT_EQ(pickerPerft(*m_chess, m_chess->m_board, 4), 197281);
+
+    ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"));
+    ASSERT_EQ(pickerPerft(*m_chess, m_chess->m_board, 3), 97862);
+
+    ASSERT_TRUE(m_chess->setBoardFromFEN("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"));
+    ASSERT_EQ(pickerPerft(*m_chess, m_chess->m_board, 4), 422333);
+
+    // Pawn takes queen comes before queen takes pawn, and the hash move is handed out once, first
+    ASSERT_TRUE(m_chess->setBoardFromFEN("4k3/8/8/3q4/4P3/8/8/3QK3 w - - 0 1"));
+
+    ScoredMove sm;
+    uint16_t hashMove;
+
+    {
+        MovePicker picker(*m_chess, m_chess->m_board, 0, 0);
+        ASSERT_TRUE(picker.next(sm));
+        ASSERT_EQ(sm.type, CAPTURE);
+        ASSERT_EQ(sm.piece, PIECE_PAWN);
+        ASSERT_TRUE(picker.next(sm));
+        ASSERT_EQ(sm.type, CAPTURE);
+        ASSERT_EQ(sm.piece, PIECE_QUEEN);
+        ASSERT_TRUE(picker.next(sm));
+        ASSERT_NE(sm.type, CAPTURE);
+        hashMove = sm.packed();
+    }
+
+    MovePicker picker(*m_chess, m_chess->m_board, hashMove, 0);
+    int count = 0;
+
+    ASSERT_TRUE(picker.next(sm));
+    ASSERT_EQ(sm.packed(), hashMove);
+
+    while (picker.next(sm))
+    {
+        ASSERT_NE(sm.packed(), hashMove);
+        count++;
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> divide;
+    ASSERT_EQ(count + 1, m_chess->perftDivide(1, divide));
+}
+
+TEST_F(ChessTest, movePickerKillers)
+{
+    // Killers come first among the quiet moves, then moves with the most history
+    ScoredMove sm;
+    uint16_t killer = Chess::packMove(1ULL << 6, 1ULL << 21, BASIC_MOVE);     // g1f3
+    uint16_t history = Chess::packMove(1ULL << 1, 1ULL << 16, BASIC_MOVE);    // b1a3
+
+    m_chess->updateQuietHistory(true, history, 4, 1);
+    m_chess->updateQuietHistory(true, killer, 1, 0);
+
+    MovePicker picker(*m_chess, m_chess->m_board, 0, 0);
+
+    ASSERT_TRUE(picker.next(sm));
+    ASSERT_EQ(sm.packed(), killer);
+    ASSERT_TRUE(picker.next(sm));
+    ASSERT_EQ(sm.packed(), history);
+
+    // A new search forgets the killers but keeps half of the history
+    m_chess->clearKillers();
+    m_chess->ageQuietHistory();
+    ASSERT_EQ(m_chess->m_history[1][1][16], 8);
+
+    MovePicker picker2(*m_chess, m_chess->m_board, 0, 0);
+
+    ASSERT_TRUE(picker2.next(sm));
+    ASSERT_EQ(sm.packed(), history);
+}
+
+TEST_F(ChessTest, movePickerHashMoveLegality)
+{
+    // A hash move is only tried if the generator would produce it, and never changes the board
+    const std::pair<const char*, uint16_t> cases[] = {
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", Chess::packMove(1ULL << 12, 1ULL << 28, BASIC_MOVE) },       // e2e4
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", Chess::packMove(1ULL << 5, 1ULL << 33, BASIC_MOVE) },        // Bb5 through e2
+        { "4k3/8/8/8/8/4n3/4P3/4K3 w - - 0 1", Chess::packMove(1ULL << 12, 1ULL << 28, BASIC_MOVE) },                              // e4 blocked
+        { "4k3/4r3/8/8/8/8/4N3/4K3 w - - 0 1", Chess::packMove(1ULL << 12, 1ULL << 18, BASIC_MOVE) },                              // Nc3 pinned
+        { "4k3/8/8/8/8/8/8/4K2R w K - 0 1", Chess::packMove(1ULL << 4, 1ULL << 6, CASTLE_KING_SIDE) },                             // O-O
+        { "4k3/8/8/8/8/8/8/4K2R w - - 0 1", Chess::packMove(1ULL << 4, 1ULL << 6, CASTLE_KING_SIDE) },                             // No right
+        { "4k3/8/8/8/8/8/8/4K3 w - - 0 1", Chess::packMove(1ULL << 4, 1ULL << 6, CASTLE_KING_SIDE) },                              // No rook
+        { "4k3/8/8/8/8/8/5r2/4K2R w K - 0 1", Chess::packMove(1ULL << 4, 1ULL << 6, CASTLE_KING_SIDE) },                           // Through f1
+        { "4k3/8/8/8/8/8/8/R3K3 w Q - 0 1", Chess::packMove(1ULL << 4, 1ULL << 2, CASTLE_QUEEN_SIDE) },                            // O-O-O
+    };
+
+    for (auto& [fen, hashMove] : cases)
+    {
+        ASSERT_TRUE(m_chess->setBoardFromFEN(fen));
+
+        std::vector<uint16_t> legal;
+        bool oppKingDead = false;
+
+        m_chess->generateMovesFast<false>(m_chess->m_board, [&] (ChessBoard&, uint64_t from, uint64_t to, enum MoveType type) {
+            legal.push_back(Chess::packMove(from, to, type));
+            return false;
+        }, oppKingDead);
+
+        bool expected = std::find(legal.begin(), legal.end(), hashMove) != legal.end();
+        uint64_t hash = m_chess->m_board.hash();
+
+        MovePicker picker(*m_chess, m_chess->m_board, hashMove, 0);
+        ScoredMove sm;
+        size_t n = 0;
+
+        ASSERT_TRUE(picker.next(sm));
+        ASSERT_EQ(sm.packed() == hashMove, expected) << fen;
+        n++;
+
+        while (picker.next(sm)) n++;
+
+        ASSERT_EQ(n, legal.size()) << fen;
+        ASSERT_EQ(m_chess->m_board.hash(), hash) << fen;
+    }
+}
+
+TEST_F(ChessTest, staticExchangeEvaluation)
+{
+    struct {
+        const char* fen;
+        const char* move;
+        int see;
+    } tests[] = {
+        // Undefended pawn
+        { "1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - - 0 1", "e1e5", 100 },
+        // Nxe5 Nxe5 Rxe5 Bxe5 Qxe5 Qxe5, with the queens x-raying through the rook and bishop
+        { "1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1", "d3e5", -200 },
+        // Queen takes a pawn defended by a pawn
+        { "k7/8/3p4/4p2Q/8/8/8/4K3 w - - 0 1", "h5e5", -800 },
+        // Pawn takes a defended knight
+        { "k7/8/2p5/3n4/4P3/8/8/4K3 w - - 0 1", "e4d5", 200 },
+        // Bishop for knight
+        { "k7/8/2p5/3n4/8/8/6B1/4K3 w - - 0 1", "g2d5", 0 },
+        // The second rook behind the first wins the exchange on d5
+        { "3r2k1/8/8/3r4/8/8/3R4/3R2K1 w - - 0 1", "d2d5", 500 },
+        // Without it, Rxd5 Rxd5 only trades rooks
+        { "3r2k1/8/8/3r4/8/8/3R4/6K1 w - - 0 1", "d2d5", 0 },
+        // En passant
+        { "k7/8/8/3pP3/8/8/8/4K3 w - d6 0 1", "e5d6", 100 },
+        // Promoting on a square the rook covers gives the queen away for the pawn
+        { "r6k/1P6/8/8/8/8/8/4K3 w - - 0 1", "b7b8q", -100 },
+        { "7k/1P6/8/8/8/8/8/4K3 w - - 0 1", "b7b8q", 800 },
+        // The king recaptures last, and only on a square that is no longer defended
+        { "k7/8/2b5/3r4/4K3/8/8/3R4 w - - 0 1", "d1d5", 300 },
+        { "k2r4/8/2b5/3r4/4K3/8/8/3R4 w - - 0 1", "d1d5", 0 },
+    };
+
+    for (auto& t : tests)
+    {
+        ASSERT_TRUE(m_chess->setBoardFromFEN(t.fen));
+
+        bool oppKingDead = false;
+        bool found = false;
+
+        m_chess->generateMovesFast<false>(m_chess->m_board, [&] (ChessBoard& b, uint64_t from, uint64_t to, enum MoveType type) {
+            if (Chess::moveToString(from, to, type) != t.move) return false;
+
+            int see = m_chess->see(b, from, to, type);
+            printf("SEE %s %s: %d\n", t.fen, t.move, see);
+            EXPECT_EQ(see, t.see) << t.fen << " " << t.move;
+            found = true;
+            return true;
+        }, oppKingDead);
+
+        ASSERT_TRUE(found) << t.fen << " " << t.move;
+    }
+
+    // Cost per call, over every capture in a few middlegame positions
+    const char* positions[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1",
+        "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    };
+
+    constexpr int kRounds = 100'000;
+    uint64_t calls = 0;
+    int64_t sum = 0;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    for (const char* fen : positions)
+    {
+        ASSERT_TRUE(m_chess->setBoardFromFEN(fen));
+
+        std::vector<std::tuple<uint64_t, uint64_t, enum MoveType>> captures;
+        bool oppKingDead = false;
+
+        m_chess->generateMovesFast<false, GEN_CAPTURES>(m_chess->m_board, [&] (ChessBoard&, uint64_t from, uint64_t to, enum MoveType type) {
+            captures.emplace_back(from, to, type);
+            return false;
+        }, oppKingDead);
+
+        for (int r = 0; r < kRounds; r++)
+            for (auto& [from, to, type] : captures)
+                sum += m_chess->see(m_chess->m_board, from, to, type);
+
+        calls += kRounds * captures.size();
+    }
+
+    auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    printf("SEE: %1.2f ns per call (%ld)\n", usecs.count() * 1'000.0 / calls, sum);
+}
+
+TEST_F(ChessTest, quiescenceHangingPiece)
+{
+    // Qxe5 wins a pawn at depth 1 unless the search sees dxe5
+    ASSERT_TRUE(m_chess->setBoardFromFEN("k7/8/3p4/4p2Q/8/8/8/4K3 w - - 0 1"));
+
+    for (bool quiescence : { false, true })
+    {
+        ChessMove move;
+        uint64_t npos = 0;
+
+        m_chess->m_useQuiescence = quiescence;
+        m_chess->m_useTranspositionTable = false;
+        m_chess->m_qsearchNodes = 0;
+        m_chess->minimaxAlphaBetaFaster(m_chess->m_board, true, move, true, 1, npos, -1e10, 1e10);
+
+        printf("Quiescence %s: %ld nodes, %ld quiescence nodes\n", quiescence ? "on" : "off", npos, m_chess->m_qsearchNodes);
+
+        bool takesPawn = move.x1 == 7 && move.y1 == 4 && move.x2 == 4 && move.y2 == 4;
+        ASSERT_EQ(takesPawn, !quiescence);
+    }
+}
+
+TEST_F(ChessTest, principalVariationSearch)
+{
+    const char* positions[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    };
+
+    // The pruning is unsound by design, so only the window handling is compared with minimax
+    m_chess->m_useNullMove = false;
+    m_chess->m_useLMR = false;
+    m_chess->m_useFutility = false;
+
+    // With a full window, the null window searches must not change the score at the root
+    for (const char* fen : positions)
+    {
+        ASSERT_TRUE(m_chess->setBoardFromFEN(fen));
+
+        for (int depth = 1; depth <= 4; depth++)
+        {
+            ChessMove m1, m2;
+            uint64_t npos1 = 0, npos2 = 0;
+
+            m_chess->m_tt->clear();
+            double minimax = m_chess->minimaxAlphaBetaFaster(m_chess->m_board, m_chess->m_board.m_isWhitesTurn, m1, true, depth, npos1, -1e10, 1e10);
+
+            m_chess->m_tt->clear();
+            double pvs = m_chess->principalVariationSearch(m_chess->m_board, m2, depth, npos2, -1e10, 1e10);
+
+            ASSERT_NEAR(minimax, pvs, 1e-6) << fen << " depth " << depth;
+        }
+    }
+
+    // Nodes and time to depth for each search
+    SearchLimits limits;
+    limits.moveTimeMs = 600'000;
+    limits.maxDepth = 6;
+    m_chess->setSearchLimits(limits);
+
+    for (bool pvs : { false, true })
+    {
+        uint64_t totalNodes = 0;
+        double totalTime = 0.0;
+
+        m_chess->m_usePVS = pvs;
+
+        for (const char* fen : positions)
+        {
+            ASSERT_TRUE(m_chess->setBoardFromFEN(fen));
+            m_chess->m_tt->clear();
+
+            int x1, y1, x2, y2;
+            PromotionType promote;
+
+            auto startTime = std::chrono::high_resolution_clock::now();
+            m_chess->getBestMove(x1, y1, x2, y2, promote);
+            auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+
+            totalNodes += m_chess->m_searchNodes;
+            totalTime  += usecs.count() / 1'000'000.0;
+        }
+
+        printf("%s: depth %d in %lu nodes, %1.3f sec\n", pvs ? "PVS" : "Alpha-beta", limits.maxDepth, totalNodes, totalTime);
+    }
+}
+
+TEST_F(ChessTest, nullMovePruning)
+{
+    uint64_t nodes[2];
+
+    // Frontier pruning already cuts most of what null move would at this depth
+    m_chess->m_useFutility = false;
+
+    for (bool nullMove : { false, true })
+    {
+        m_chess->m_useNullMove = nullMove;
+        nodes[nullMove] = RunSearch(kSearchPositions, 7);
+
+        printf("Null move %s: depth 7 in %lu nodes\n", nullMove ? "on" : "off", nodes[nullMove]);
+    }
+
+    ASSERT_LT(nodes[1], nodes[0]);
+
+    // With only kings and pawns left zugzwang is common, so neither side may pass
+    m_chess->m_useNullMove = true;
+    ASSERT_TRUE(m_chess->setBoardFromFEN("8/8/8/3k4/8/3p1p2/8/4K3 w - - 0 1"));
+
+    ChessMove move;
+    uint64_t npos = 0;
+
+    m_chess->m_tt->clear();
+    m_chess->m_nullMoveTries = 0;
+    m_chess->principalVariationSearch(m_chess->m_board, move, 6, npos, -1e10, 1e10);
+    ASSERT_EQ(m_chess->m_nullMoveTries, 0);
+}
+
+TEST_F(ChessTest, lateMoveReductions)
+{
+    uint64_t nodes[2];
+
+    m_chess->m_useFutility = false;
+
+    for (bool lmr : { false, true })
+    {
+        m_chess->m_useLMR = lmr;
+        nodes[lmr] = RunSearch(kSearchPositions, 8);
+
+        printf("LMR %s: depth 8 in %lu nodes, last iteration %lu reductions, %lu re-searches\n", lmr ? "on" : "off",
+                nodes[lmr], m_chess->m_lmrReductions, m_chess->m_lmrReSearches);
+
+        if (lmr)
+        {
+            ASSERT_GT(m_chess->m_lmrReductions, 0);
+            ASSERT_LT(m_chess->m_lmrReSearches, m_chess->m_lmrReductions);
+        }
+        else
+            ASSERT_EQ(m_chess->m_lmrReductions, 0);
+    }
+
+    ASSERT_LT(nodes[1], nodes[0]);
+}
+
+TEST_F(ChessTest, frontierPruning)
+{
+    uint64_t nodes[2];
+
+    for (bool futility : { false, true })
+    {
+        m_chess->m_useFutility = futility;
+        nodes[futility] = RunSearch(kSearchPositions, 8);
+
+        printf("Frontier pruning %s: depth 8 in %lu nodes\n", futility ? "on" : "off", nodes[futility]);
+
+        // Counts are for the last position
+        uint64_t pruned = m_chess->m_futilityPrunes + m_chess->m_reverseFutilityPrunes + m_chess->m_razorPrunes;
+
+        if (futility)
+        {
+            ASSERT_GT(m_chess->m_futilityPrunes, 0);
+            ASSERT_GT(m_chess->m_reverseFutilityPrunes, 0);
+            ASSERT_GT(m_chess->m_razorPrunes, 0);
+        }
+        else
+            ASSERT_EQ(pruned, 0);
+    }
+
+    ASSERT_LT(nodes[1], nodes[0]);
+
+    // Pruning mustn't hide a mate behind a quiet move: 1. Kb6 Kb8 2. Rh8#
+    ASSERT_TRUE(m_chess->setBoardFromFEN("k7/8/2K5/8/8/8/8/7R w - - 0 1"));
+
+    ChessMove move;
+    uint64_t npos = 0;
+
+    m_chess->m_tt->clear();
+    double score = m_chess->principalVariationSearch(m_chess->m_board, move, 4, npos, -1e10, 1e10);
+
+    ASSERT_GT(score, 1000.0);
+}
+
+TEST_F(ChessTest, principalVariation)
+{
+    // Play the line out on a copy of the board, checking each move is legal
+    auto playLine = [&] (ChessBoard& board) {
+        for (uint16_t move : m_chess->m_principalVariation)
+        {
+            bool legal = false;
+            bool oppKingDead = false;
+
+            m_chess->generateMovesFast<false>(board, [&] (ChessBoard&, uint64_t from, uint64_t to, enum MoveType type) {
+                legal = Chess::packMove(from, to, type) == move;
+                return legal;
+            }, oppKingDead);
+
+            ASSERT_TRUE(legal);
+
+            uint64_t from = 1ULL << (move & 63);
+            UndoRecord undo;
+
+            board.makeMove((enum SimplePieceTypes)board.pieceOn(from, board.m_isWhitesTurn), from, 1ULL << ((move >> 6) & 63),
+                           (enum MoveType)(move >> 12), undo);
+        }
+    };
+
+    const char* positions[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r1bq1rk1/pp2bppp/2n1pn2/2pp4/3P4/2PBPN2/PP1N1PPP/R1BQ1RK1 w - - 0 8",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    };
+
+    SearchLimits limits;
+    limits.moveTimeMs = 600'000;
+    limits.maxDepth = 8;
+    m_chess->setSearchLimits(limits);
+
+    for (const char* fen : positions)
+    {
+        ASSERT_TRUE(m_chess->setBoardFromFEN(fen));
+        m_chess->m_tt->clear();
+
+        int x1, y1, x2, y2;
+        PromotionType promote;
+
+        m_chess->getBestMove(x1, y1, x2, y2, promote);
+
+        auto& pv = m_chess->m_principalVariation;
+
+        printf("PV: %s\n", m_chess->pvToString().c_str());
+
+        // The line starts with the move played and runs about as deep as the search
+        ASSERT_FALSE(pv.empty());
+        ASSERT_LE(pv.size(), 8u);
+        ASSERT_EQ(pv[0] & 63, y1 * 8 + x1);
+        ASSERT_EQ((pv[0] >> 6) & 63, y2 * 8 + x2);
+
+        ChessBoard board = m_chess->m_board;
+        playLine(board);
+    }
+
+    // A mate in two ends with the mate: 1. Kb6 Kb8 2. Rh8# or 1. Kc7 Ka7 2. Ra1#
+    ASSERT_TRUE(m_chess->setBoardFromFEN("k7/8/2K5/8/8/8/8/7R w - - 0 1"));
+    m_chess->m_tt->clear();
+
+    limits.maxDepth = 5;
+    m_chess->setSearchLimits(limits);
+
+    int x1, y1, x2, y2;
+    PromotionType promote;
+
+    m_chess->getBestMove(x1, y1, x2, y2, promote);
+
+    ASSERT_EQ(m_chess->m_principalVariation.size(), 3u);
+
+    ChessBoard board = m_chess->m_board;
+    playLine(board);
+
+    int replies = 0;
+    bool oppKingDead = false;
+
+    m_chess->generateMovesFast<false>(board, [&] (ChessBoard&, uint64_t, uint64_t, enum MoveType) {
+        replies++;
+        return false;
+    }, oppKingDead);
+
+    ASSERT_EQ(replies, 0);
+    ASSERT_TRUE(m_chess->sideToMoveInCheck(board));
+
+    // A line that doesn't fit the position is ignored: castling with no rook on h1
+    ASSERT_TRUE(m_chess->setBoardFromFEN("4k3/8/8/8/8/8/8/4K3 w - - 0 1"));
+    m_chess->m_tt->clear();
+
+    uint64_t hash = m_chess->m_board.hash();
+    ChessMove move;
+    uint64_t npos = 0;
+
+    m_chess->m_principalVariation = { Chess::packMove(1ULL << 4, 1ULL << 6, CASTLE_KING_SIDE) };
+    m_chess->m_followPV = true;
+    m_chess->principalVariationSearch(m_chess->m_board, move, 3, npos, -1e10, 1e10);
+
+    ASSERT_EQ(m_chess->m_board.hash(), hash);
+    ASSERT_EQ(m_chess->m_board.whiteRooksBoard, 0ULL);
+    ASSERT_NE(m_chess->m_pvTable[0][0], m_chess->m_principalVariation[0]);
+}
+
+TEST_F(ChessTest, DISABLED_searchNodesToDepth)
+{
+    // Nodes searched to a fixed depth, the measure of how well the moves are ordered
+    const char* positions[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r1bq1rk1/pp2bppp/2n1pn2/2pp4/3P4/2PBPN2/PP1N1PPP/R1BQ1RK1 w - - 0 8",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    };
+
+    SearchLimits limits;
+    limits.moveTimeMs = 600'000;
+    limits.maxDepth = 5;
+    m_chess->setSearchLimits(limits);
+
+    uint64_t totalNodes = 0;
+
+    for (const char* fen : positions)
+    {
+        ASSERT_TRUE(m_chess->setBoardFromFEN(fen));
+        m_chess->m_tt->clear();
+
+        int x1, y1, x2, y2;
+        PromotionType promote;
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        m_chess->getBestMove(x1, y1, x2, y2, promote);
+        auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+
+        printf("Depth %d: %10lu nodes %10lu quiescence nodes %7.3f sec  %s\n", limits.maxDepth, m_chess->m_searchNodes,
+                m_chess->m_qsearchNodes, usecs.count() / 1'000'000.0, fen);
+        totalNodes += m_chess->m_searchNodes;
+
+        ASSERT_EQ(m_chess->m_completedDepth, limits.maxDepth);
+        ASSERT_NE(x1, INVALID_FILE);
+    }
+
+    printf("Total nodes: %lu\n", totalNodes);
+}
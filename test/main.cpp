@@ -31,7 +31,7 @@ SOFTWARE.
 
 #include <gtest/gtest.h>
 
-//#include "chessTest.cpp"
+#include "chessTest.cpp"
 #include "betaChessTest.cpp"
 
 int main(int argc, char** argv)
@@ -0,0 +1,50 @@
+/* vim: set et ts=4 sw=4: */
+
+/*
+	slurmemu-ng: Next-Generation Slurm16 emulator
+
+perftResults.h: Published perft counts shared by the engine tests
+
+License: MIT License
+
+Copyright 2023 J.R.Sharp
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+// https://www.chessprogramming.org/Perft_Results
+
+// Start position, indexed by depth
+static constexpr uint64_t kStartPositionPerft[] = { 1, 20, 400, 8902, 197'281, 4'865'609, 119'060'324 };
+
+// Some of the start position's perft(3), split by first move
+static const std::pair<const char*, uint64_t> kStartPositionDivide3[] = {
+    { "a2a3", 380 },
+    { "e2e4", 600 },
+    { "g1f3", 440 },
+};
+
+static constexpr const char* kKiwipeteFEN = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+static constexpr uint64_t kKiwipetePerft4 = 4'085'603;